@@ -0,0 +1,373 @@
+#include "Benchmark.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "ColumnStore.h"
+#include "Depressions.h"
+#include "Drop.h"
+#include "FloodFill.h"
+#include "HaloGrid.h"
+#include "Lakes.h"
+#include "Map.h"
+#include "Node.h"
+#include "PerlinNoise.h"
+#include "Random.h"
+
+void Benchmark::run()
+{
+	cascade(256, 2000);
+	heightQueries(256, 20);
+	soilMixing(256, 20);
+	erosionAccuracy(128, 10);
+	fullPalette(100000);
+	nodeLayouts(512, 5);
+	snapshots(512, 5);
+	flood(500, 500);
+}
+
+Node* Benchmark::layeredSlope(int size, ColumnStore& columns, MapParams& params, float& maxHeight)
+{
+	Node* nodes = new Node[size * size];
+	PerlinNoise noise(1234);
+	const int layers = params.generatedMapDensity * 2;
+
+	// A bumpy slope, with a full column of soil markers under every node
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			Node& node = nodes[y * size + x];
+			const float height = (x + y) * 0.1f + noise.noise(x / 20.0, y / 20.0, 0.5) * 4.0f + BEDROCK_SAFETY_LAYER;
+			node.attach(&columns, layers + 2);
+			node.setWaterDepth(0.0f);
+			node.setParticles(0.0f);
+			node.setFoliageDensity(0.0f);
+			node.addMarker(BEDROCK_LAYER, params.bedrockResisitivity, true, glm::vec3(0.1f), 0.0f, 0.0f, 0.0f, maxHeight);
+			for (int i = 1; i <= layers; ++i)
+			{
+				float layerNoise = noise.noise(x / 50.0, y / 50.0, i * 0.3);
+				NodeMarker layer(height * i / (layers + 1), params.soilResistivityBase + layerNoise * params.soilResistivityVariance, false, glm::vec3(0.2f + layerNoise * 0.2f, 0.3f, 0.0f), params.soilFertility, params.soilSandContent, params.soilClayContent);
+				node.addMarker(layer, maxHeight);
+			}
+			node.addMarker(height, params.soilResistivityBase, false, glm::vec3(0.3f, 0.3f, 0.0f), params.soilFertility, params.soilSandContent, params.soilClayContent, maxHeight);
+		}
+	}
+
+	return nodes;
+}
+
+void Benchmark::cascade(int size, int drops)
+{
+	MapParams params;
+	ColumnStore columns;
+	float maxHeight = 0.0f;
+	Node* nodes = layeredSlope(size, columns, params, maxHeight);
+
+	HaloGrid grid;
+	grid.build(size, size);
+	auto getNormal = [&](int x, int y)
+	{
+		auto heightAt = [&](int nx, int ny) { return nodes[grid.at(nx, ny)].waterHeight(); };
+		return glm::normalize(glm::vec3(2 * (heightAt(x - 1, y) - heightAt(x + 1, y)), 2 * (heightAt(x, y - 1) - heightAt(x, y + 1)), -4));
+	};
+
+	bool* track = new bool[size * size];
+	std::fill(track, track + size * size, false);
+	long long steps = 0;
+	Random random(1234);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < drops; ++i)
+	{
+		Drop drop(glm::vec2(random.range(RandomStage_DropX, glm::ivec2(i, 0), 0, size), random.range(RandomStage_DropY, glm::ivec2(i, 0), 0, size)), &params);
+		while (drop.getVolume() > drop.getMinVolume() && drop.getAge() < 1000)
+		{
+			glm::vec2 pos = drop.getPosition();
+			if (!drop.descend(getNormal((int)pos.x, (int)pos.y), nodes, grid, track, maxHeight))
+				break;
+			steps++;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Cascade: " << drops << " drops took " << steps << " steps in " << elapsed.count() << "s (" << steps / elapsed.count() << " steps/s)" << std::endl;
+
+	delete[] track;
+	delete[] nodes;
+}
+
+void Benchmark::heightQueries(int size, int passes)
+{
+	MapParams params;
+	ColumnStore columns;
+	float maxHeight = 0.0f;
+	Node* nodes = layeredSlope(size, columns, params, maxHeight);
+	long long queries = 0;
+	float checksum = 0.0f;
+
+	// Sweep a slice down through every column, the way renderAtHeight does
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		const float height = maxHeight * (pass + 0.5f) / passes;
+		for (int i = 0; i < size * size; ++i)
+		{
+			checksum += nodes[i].getColorAtHeight(height).x + nodes[i].getResistiveForceAtHeight(height);
+			queries += 2;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Height queries: " << queries << " queries in " << elapsed.count() << "s (" << queries / elapsed.count() << " queries/s, checksum " << checksum << ")" << std::endl;
+
+	delete[] nodes;
+}
+
+void Benchmark::soilMixing(int size, int passes)
+{
+	MapParams params;
+	ColumnStore columns;
+	float maxHeight = 0.0f;
+	Node* nodes = layeredSlope(size, columns, params, maxHeight);
+	long long queries = 0;
+	float checksum = 0.0f;
+
+	// Mix ever deeper slices off the top of every column, as pool transport and soil classification do
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		const float depth = maxHeight * (pass + 0.5f) / passes;
+		for (int i = 0; i < size * size; ++i)
+		{
+			checksum += nodes[i].getDataAboveHeight(nodes[i].topHeight() - depth).resistiveForce + nodes[i].getDataAboveHeight(nodes[i].topHeight() - depth, true).sandAmount;
+			queries += 2;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Soil mixing: " << queries << " queries in " << elapsed.count() << "s (" << queries / elapsed.count() << " queries/s, checksum " << checksum << ")" << std::endl;
+
+	delete[] nodes;
+}
+
+void Benchmark::erosionAccuracy(int size, int years)
+{
+	MapParams params;
+	Map map(size, size, params, 1234);
+	for (int i = 0; i < years; ++i)
+	{
+		map.erode(100);
+		map.grow();
+	}
+
+	// Each node's surface marker and the mix of soil drops carry away from it are stored in a slot of their own and read back.
+	// The mix hasn't been stored before, so holds properties the encoding hasn't rounded yet.
+	ColumnStore store;
+	const int slot = store.allocate(1);
+	const int fieldCount = 8;
+	const char* fieldNames[fieldCount] = { "height", "resistance", "red", "green", "blue", "sand", "clay", "fertility" };
+	const float bounds[fieldCount] = { 0.0f, MARKER_RESIST_ERROR, MARKER_COLOR_ERROR, MARKER_COLOR_ERROR, MARKER_COLOR_ERROR, MARKER_FRACTION_ERROR, MARKER_FRACTION_ERROR, MARKER_FRACTION_ERROR };
+	float maxError[fieldCount] = {};
+	bool hardStopsKept = true;
+	int markers = 0;
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			Node* node = map.getNodeAt(x, y);
+			const NodeMarker originals[2] = { node->top(), node->getDataAboveHeight(node->topHeight() - 1.0f, true) };
+			for (const NodeMarker& original : originals)
+			{
+				store.set(slot, original);
+				const NodeMarker stored = store.get(slot);
+				const float errors[fieldCount] = { glm::abs(stored.height - original.height), glm::abs(stored.resistiveForce - original.resistiveForce),
+					glm::abs(stored.color.r - original.color.r), glm::abs(stored.color.g - original.color.g), glm::abs(stored.color.b - original.color.b),
+					glm::abs(stored.sandAmount - original.sandAmount), glm::abs(stored.clayAmount - original.clayAmount), glm::abs(stored.fertility - original.fertility) };
+				for (int field = 0; field < fieldCount; ++field)
+					maxError[field] = glm::max(maxError[field], errors[field]);
+				hardStopsKept = hardStopsKept && stored.hardStop == original.hardStop;
+				markers++;
+			}
+		}
+	}
+
+	bool withinBounds = hardStopsKept;
+	std::cout << "Erosion accuracy: " << markers << " markers stored at " << ColumnStore::bytesPerMarker() << " bytes per marker, max errors";
+	for (int field = 0; field < fieldCount; ++field)
+	{
+		withinBounds = withinBounds && maxError[field] <= bounds[field];
+		std::cout << (field == 0 ? " " : ", ") << fieldNames[field] << " " << maxError[field];
+	}
+	std::cout << (hardStopsKept ? "" : ", HARD STOPS LOST") << (withinBounds ? ", within bounds" : ", OUT OF BOUNDS") << std::endl;
+	assert(withinBounds);
+}
+
+void Benchmark::fullPalette(int markers)
+{
+	// Every property is drawn from within the first two of its coarse bins, which the palette fills with materials long before it's full
+	Random random(1234);
+	auto draw = [&](int i, int iteration)
+	{
+		auto value = [&](int field, float max) { return (random.get(RandomStage_DropX, glm::ivec2(i, field), iteration) >> 8) / 16777216.0f * max; };
+		return NodeMarker(0.0f, value(0, 31.5f / 256.0f), value(1, 2.0f) >= 1.0f, glm::vec3(value(2, 7.5f / 31.0f), value(3, 15.5f / 63.0f), value(4, 7.5f / 31.0f)),
+			value(5, 31.5f / 255.0f), value(6, 31.5f / 255.0f), value(7, 31.5f / 255.0f));
+	};
+
+	MaterialPalette palette;
+	for (int i = 0; palette.getSize() < PALETTE_MAX_MATERIALS; ++i)
+		palette.intern(draw(i, 0));
+
+	float resistError = 0.0f;
+	float colorError = 0.0f;
+	float fractionError = 0.0f;
+	bool hardStopsKept = true;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < markers; ++i)
+	{
+		const NodeMarker original = draw(i, 1);
+		const Material& material = palette.get(palette.intern(original));
+		const glm::vec3 colorDiff = glm::abs(material.color - original.color);
+		resistError = glm::max(resistError, glm::abs(material.resistiveForce - original.resistiveForce));
+		colorError = glm::max(colorError, glm::max(colorDiff.r, glm::max(colorDiff.g, colorDiff.b)));
+		fractionError = glm::max(fractionError, glm::max(glm::abs(material.fertility - original.fertility), glm::max(glm::abs(material.sandAmount - original.sandAmount), glm::abs(material.clayAmount - original.clayAmount))));
+		hardStopsKept = hardStopsKept && material.hardStop == original.hardStop;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// A marker unlike any material is matched against all of them, with no bound on how far off the nearest is
+	const NodeMarker unlike(0.0f, 40.0f, false, glm::vec3(1.0f), 1.0f, 1.0f, 1.0f);
+	start = std::chrono::steady_clock::now();
+	const Material& nearest = palette.get(palette.intern(unlike));
+	std::chrono::duration<double> unlikeTime = std::chrono::steady_clock::now() - start;
+
+	const bool withinBounds = hardStopsKept && resistError <= PALETTE_FULL_RESIST_ERROR && colorError <= PALETTE_FULL_COLOR_ERROR && fractionError <= PALETTE_FULL_FRACTION_ERROR;
+	std::cout << "Full palette: " << markers << " markers interned in " << elapsed.count() << "s, max errors resistance " << resistError << ", color " << colorError << ", fractions " << fractionError
+		<< (hardStopsKept ? "" : ", HARD STOPS LOST") << (withinBounds ? ", within bounds" : ", OUT OF BOUNDS") << ". Unlike marker took " << unlikeTime.count() << "s, resistance off by "
+		<< glm::abs(nearest.resistiveForce - unlike.resistiveForce) << std::endl;
+	assert(withinBounds);
+}
+
+void Benchmark::nodeLayouts(int size, int years)
+{
+	const char* layoutNames[2] = { "row by row", "tiled" };
+	for (int tiled = 0; tiled < 2; ++tiled)
+	{
+		MapParams params;
+		params.tiledNodeLayout = tiled;
+		Map map(size, size, params, 1234);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < years; ++i)
+			map.erode(1000);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::cout << "Node layout (" << layoutNames[tiled] << "): " << years * 1000 << " drops in " << elapsed.count() << "s (" << years * 1000 / elapsed.count() << " drops/s)" << std::endl;
+	}
+}
+
+void Benchmark::snapshots(int size, int years)
+{
+	MapParams params;
+	Map map(size, size, params, 1234);
+
+	auto checksum = [&](Map& target)
+	{
+		double sum = 0.0;
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				Node* node = target.getNodeAt(x, y);
+				sum += node->topHeight() + node->waterDepth() + node->getDataAboveHeight(node->topHeight() - 1.0f).resistiveForce;
+			}
+		}
+		return sum;
+	};
+	const double original = checksum(map);
+
+	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<const MapSnapshot> snapshot = map.snapshot();
+	std::chrono::duration<double> snapshotTime = std::chrono::steady_clock::now() - start;
+
+	// A what-if run with faster evaporating drops
+	MapParams forkParams;
+	forkParams.particleEvaporationRate = 0.95f;
+	start = std::chrono::steady_clock::now();
+	Map fork(*snapshot, forkParams);
+	std::chrono::duration<double> forkTime = std::chrono::steady_clock::now() - start;
+	for (int i = 0; i < years; ++i)
+	{
+		fork.erode(1000);
+		map.erode(1000);
+	}
+
+	int shared = 0;
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			shared += fork.getNodeAt(x, y)->isShared();
+		}
+	}
+
+	start = std::chrono::steady_clock::now();
+	map.rollback(*snapshot);
+	std::chrono::duration<double> rollbackTime = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Snapshots: snapshot took " << snapshotTime.count() << "s, fork " << forkTime.count() << "s, rollback " << rollbackTime.count() << "s. "
+		<< shared * 100.0f / (size * size) << "% of the fork's columns still shared after " << years << " years, rollback " << (checksum(map) == original ? "exact" : "INEXACT") << std::endl;
+}
+
+void Benchmark::flood(int size, int drops)
+{
+	MapParams params;
+	ColumnStore columns;
+	Node* nodes = new Node[size * size];
+	float maxHeight = 0.0f;
+	const int center = size / 2;
+
+	// The bowl of FLOODTESTMAP, with no water on it yet
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			Node& node = nodes[y * size + x];
+			node.attach(&columns, 2);
+			node.setWaterDepth(0.0f);
+			node.setParticles(0.0f);
+			node.setFoliageDensity(0.0f);
+			node.addMarker(BEDROCK_LAYER, params.bedrockResisitivity, true, glm::vec3(0.1f), 0.0f, 0.0f, 0.0f, maxHeight);
+			node.addMarker((abs(x - center) + abs(y - center)) / 20.0f + BEDROCK_SAFETY_LAYER, params.soilResistivityBase, false, glm::vec3(0.3f, 0.3f, 0.0f), params.soilFertility, params.soilSandContent, params.soilClayContent, maxHeight);
+		}
+	}
+
+	HaloGrid grid;
+	grid.build(size, size);
+	FloodFill fill;
+	fill.setArea(&grid, glm::ivec4(0, 0, size, size));
+	Depressions depressions;
+	depressions.build(nodes, &grid);
+	Lakes lakes;
+	lakes.clear(&grid);
+	Random random(1234);
+
+	// Drops settle at the bottom of the bowl, spread a little so they don't all flood from the same node
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < drops; ++i)
+	{
+		Drop drop(glm::vec2(center - 2 + random.range(RandomStage_DropX, glm::ivec2(i, 0), 0, 5), center - 2 + random.range(RandomStage_DropY, glm::ivec2(i, 0), 0, 5)), &params);
+		drop.flood(nodes, grid, maxHeight, fill, depressions, lakes);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	double water = 0.0;
+	for (int i = 0; i < size * size; ++i)
+		water += nodes[i].waterDepth();
+
+	std::cout << "Flood: " << drops << " floods in " << elapsed.count() << "s (" << drops / elapsed.count() << " floods/s, " << water << " water pooled)" << std::endl;
+
+	delete[] nodes;
+}
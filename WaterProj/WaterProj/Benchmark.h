@@ -0,0 +1,84 @@
+#pragma once
+
+class ColumnStore;
+struct MapParams;
+class Node;
+
+/***************************************************************************//**
+ * Benchmark holds timing runs for the hot paths of the simulation, using
+ * static functions. Enable RUNBENCHMARKS in WaterProj.cpp to run them at
+ * startup instead of opening the simulation.
+ ******************************************************************************/
+class Benchmark {
+public:
+	/***************************************************************************//**
+	 * Runs every benchmark, printing the results to the console.
+	 ******************************************************************************/
+	static void run();
+	/***************************************************************************//**
+	 * Times drops descending a layered slope, which is dominated by the deposit
+	 * and erosion calls made from Drop::cascade.
+	 @param size The width and height of the terrain
+	 @param drops The number of drops to simulate
+	 ******************************************************************************/
+	static void cascade(int size, int drops);
+	/***************************************************************************//**
+	 * Times color and resistive force lookups on slices through a layered slope.
+	 @param size The width and height of the terrain
+	 @param passes The number of slices to take through the terrain
+	 ******************************************************************************/
+	static void heightQueries(int size, int passes);
+	/***************************************************************************//**
+	 * Times mixing the soil above a depth, for slices of increasing depth through a layered slope.
+	 @param size The width and height of the terrain
+	 @param passes The number of depths to mix down to
+	 ******************************************************************************/
+	static void soilMixing(int size, int passes);
+	/***************************************************************************//**
+	 * Erodes a generated map, then stores markers taken from it and reads them
+	 * back, checking the error the build's marker encoding brings against the
+	 * bounds listed on ColumnStore. Few enough are stored that a
+	 * COMPACT_MARKERS palette never fills.
+	 @param size The width and height of the map
+	 @param years The number of years to erode for
+	 ******************************************************************************/
+	static void erosionAccuracy(int size, int years);
+	/***************************************************************************//**
+	 * Fills a material palette, then times interning markers into it and checks
+	 * their errors against the bounds a full palette keeps to.
+	 @param markers The number of markers to intern once the palette is full
+	 ******************************************************************************/
+	static void fullPalette(int markers);
+	/***************************************************************************//**
+	 * Times eroding the same generated map with nodes stored row by row, and
+	 * then in tiles.
+	 @param size The width and height of the map
+	 @param years The number of years to erode for
+	 ******************************************************************************/
+	static void nodeLayouts(int size, int years);
+	/***************************************************************************//**
+	 * Times taking a snapshot of a generated map, forking it with different
+	 * parameters and rolling the original back after eroding it, and checks
+	 * that the rollback restores it exactly.
+	 @param size The width and height of the map
+	 @param years The number of years to erode for
+	 ******************************************************************************/
+	static void snapshots(int size, int years);
+	/***************************************************************************//**
+	 * Times drops flooding pools in a bowl, the terrain FLOODTESTMAP builds, with
+	 * the pools growing and merging as more drops are added to them.
+	 @param size The width and height of the terrain
+	 @param drops The number of drops to flood with
+	 ******************************************************************************/
+	static void flood(int size, int drops);
+protected:
+	/***************************************************************************//**
+	 * Builds a bumpy slope with a full column of soil markers under every node.
+	 @param size The width and height of the terrain
+	 @param columns The store to keep the markers in
+	 @param params The parameters to take soil values from
+	 @param maxHeight Set to the maximum height of the terrain
+	 @return The node array, to be deleted by the caller
+	 ******************************************************************************/
+	static Node* layeredSlope(int size, ColumnStore& columns, MapParams& params, float& maxHeight);
+};
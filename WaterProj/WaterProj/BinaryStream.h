@@ -0,0 +1,44 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Helpers for writing plain data to binary files, as it's laid out in memory. Only for files read back by the same build.
+
+// The most elements a vector read back from a file may have, so a damaged file can't ask for an absurd allocation
+#define BINARY_MAX_ELEMENTS (1ull << 31)
+
+template<typename T>
+void writeValue(std::ostream& stream, const T& value)
+{
+	stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool readValue(std::istream& stream, T& value)
+{
+	stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return !stream.fail();
+}
+
+template<typename T>
+void writeVector(std::ostream& stream, const std::vector<T>& values)
+{
+	writeValue(stream, (unsigned long long)values.size());
+	if (!values.empty())
+		stream.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+template<typename T>
+bool readVector(std::istream& stream, std::vector<T>& values)
+{
+	unsigned long long count;
+	if (!readValue(stream, count) || count > BINARY_MAX_ELEMENTS)
+		return false;
+
+	values.resize((size_t)count);
+	if (!values.empty())
+		stream.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T));
+	return !stream.fail();
+}
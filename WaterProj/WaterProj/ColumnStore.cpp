@@ -0,0 +1,283 @@
+#include "ColumnStore.h"
+
+#include <algorithm>
+
+#include "BinaryStream.h"
+#include "HaloGrid.h"
+#include "Node.h"
+
+void ColumnStore::reserve(int markerCount)
+{
+	heights.reserve(markerCount);
+#ifdef COMPACT_MARKERS
+	materials.reserve(markerCount);
+#else
+	resistiveForces.reserve(markerCount);
+	fertilities.reserve(markerCount);
+	sandAmounts.reserve(markerCount);
+	clayAmounts.reserve(markerCount);
+	colors.reserve(markerCount);
+	hardStops.reserve(markerCount);
+#endif
+	rockCounts.reserve(markerCount);
+	soilSums.reserve((markerCount + SOIL_SUM_STRIDE - 1) / SOIL_SUM_STRIDE);
+}
+
+void ColumnStore::resize(int size)
+{
+	heights.resize(size);
+#ifdef COMPACT_MARKERS
+	materials.resize(size);
+#else
+	resistiveForces.resize(size);
+	fertilities.resize(size);
+	sandAmounts.resize(size);
+	clayAmounts.resize(size);
+	colors.resize(size);
+	hardStops.resize(size);
+#endif
+	rockCounts.resize(size);
+	soilSums.resize((size + SOIL_SUM_STRIDE - 1) / SOIL_SUM_STRIDE);
+	m_size = size;
+}
+
+int ColumnStore::allocate(int capacity)
+{
+	int offset = m_size;
+	resize(m_size + capacity);
+	return offset;
+}
+
+void ColumnStore::release(int capacity)
+{
+	m_wasted += capacity;
+}
+
+void ColumnStore::attach(Node* nodes, int count, int capacity)
+{
+	const int offset = m_size;
+	resize(m_size + count * capacity);
+	for (int i = 0; i < count; ++i)
+	{
+		nodes[i].m_store = this;
+		nodes[i].m_owner = this;
+		nodes[i].m_offset = offset + i * capacity;
+		nodes[i].m_capacity = capacity;
+		nodes[i].m_count = 0;
+	}
+}
+
+NodeMarker ColumnStore::get(int index) const
+{
+	NodeMarker marker;
+	marker.height = heights[index];
+	marker.resistiveForce = getResistiveForce(index);
+	marker.hardStop = isHardStop(index);
+	marker.fertility = getFertility(index);
+	marker.sandAmount = getSandAmount(index);
+	marker.clayAmount = getClayAmount(index);
+	marker.color = getColor(index);
+	return marker;
+}
+
+void ColumnStore::set(int index, const NodeMarker& marker)
+{
+	heights[index] = marker.height;
+#ifdef COMPACT_MARKERS
+	materials[index] = palette.intern(marker);
+#else
+	resistiveForces[index] = marker.resistiveForce;
+	hardStops[index] = marker.hardStop;
+	fertilities[index] = marker.fertility;
+	sandAmounts[index] = marker.sandAmount;
+	clayAmounts[index] = marker.clayAmount;
+	colors[index] = marker.color;
+#endif
+}
+
+void ColumnStore::setColorAndResistiveForce(int index, glm::vec3 color, float resistiveForce)
+{
+#ifdef COMPACT_MARKERS
+	NodeMarker marker = get(index);
+	marker.color = color;
+	marker.resistiveForce = resistiveForce;
+	materials[index] = palette.intern(marker);
+#else
+	colors[index] = color;
+	resistiveForces[index] = resistiveForce;
+#endif
+}
+
+float ColumnStore::bytesPerMarker()
+{
+#ifdef COMPACT_MARKERS
+	float bytes = sizeof(decltype(heights)::value_type) + sizeof(decltype(materials)::value_type) + sizeof(RockCount);
+#else
+	float bytes = sizeof(decltype(heights)::value_type) + sizeof(decltype(resistiveForces)::value_type) + sizeof(decltype(fertilities)::value_type)
+		+ sizeof(decltype(sandAmounts)::value_type) + sizeof(decltype(clayAmounts)::value_type) + sizeof(decltype(colors)::value_type)
+		+ sizeof(decltype(hardStops)::value_type) + sizeof(RockCount);
+#endif
+	return bytes + sizeof(SoilSum) / (float)SOIL_SUM_STRIDE;
+}
+
+template<typename T>
+static void moveRange(std::vector<T>& pool, int from, int to, int count)
+{
+	if (to < from)
+		std::copy(pool.begin() + from, pool.begin() + from + count, pool.begin() + to);
+	else
+		std::copy_backward(pool.begin() + from, pool.begin() + from + count, pool.begin() + to + count);
+}
+
+void ColumnStore::move(int from, int to, int count)
+{
+	if (count <= 0 || from == to)
+		return;
+
+	moveRange(heights, from, to, count);
+#ifdef COMPACT_MARKERS
+	moveRange(materials, from, to, count);
+#else
+	moveRange(resistiveForces, from, to, count);
+	moveRange(fertilities, from, to, count);
+	moveRange(sandAmounts, from, to, count);
+	moveRange(clayAmounts, from, to, count);
+	moveRange(colors, from, to, count);
+	moveRange(hardStops, from, to, count);
+#endif
+	moveRange(rockCounts, from, to, count);
+}
+
+void ColumnStore::compact(Node* nodes, int count)
+{
+	// Columns have to be slid down in pool order so that nothing is overwritten before it has moved
+	std::vector<int> order;
+	order.reserve(count);
+	for (int i = 0; i < count; ++i)
+	{
+		if (nodes[i].m_store == this)
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return nodes[a].m_offset < nodes[b].m_offset; });
+
+	int cursor = 0;
+	const int moving = (int)order.size();
+	for (int i = 0; i < moving; ++i)
+	{
+		Node& node = nodes[order[i]];
+		const int nextOffset = (i + 1 < moving) ? nodes[order[i + 1]].m_offset : m_size;
+		move(node.m_offset, cursor, node.m_count);
+		node.m_offset = cursor;
+		node.indexColumn(0);
+		// Keep some headroom, as long as it doesn't reach the next column still waiting to move
+		node.m_capacity = glm::max(node.m_count, glm::min(node.m_count + COLUMN_HEADROOM, nextOffset - cursor));
+		cursor += node.m_capacity;
+	}
+
+	resize(cursor);
+	m_wasted = 0;
+}
+
+std::shared_ptr<ColumnStore> ColumnStore::freeze(Node* nodes, int count)
+{
+	std::shared_ptr<ColumnStore> frozen = std::make_shared<ColumnStore>(std::move(*this));
+	*this = ColumnStore();
+	setSubsurface(frozen->m_subsurface, frozen->m_nodes, frozen->m_grid);
+	for (int i = 0; i < count; ++i)
+	{
+		if (nodes[i].m_store == this)
+			nodes[i].m_store = frozen.get();
+	}
+
+	return frozen;
+}
+
+void ColumnStore::setSubsurface(Subsurface* subsurface, const Node* nodes, const HaloGrid* grid)
+{
+	m_subsurface = subsurface;
+	m_nodes = nodes;
+	m_grid = grid;
+}
+
+glm::ivec2 ColumnStore::getPosition(const Node* node) const
+{
+	return m_grid->position((int)(node - m_nodes));
+}
+
+void ColumnStore::adopt(Node* nodes, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		nodes[i].m_owner = this;
+	}
+}
+
+// The store each thread copies the columns it changes into, while redirected
+static thread_local ColumnStore* redirectedStore = nullptr;
+
+void ColumnStore::redirect(ColumnStore* store)
+{
+	redirectedStore = store;
+}
+
+ColumnStore* ColumnStore::getRedirect()
+{
+	return redirectedStore;
+}
+
+void ColumnStore::returnColumns()
+{
+	for (const std::pair<Node*, int>& borrowed : m_borrowed)
+	{
+		Node* node = borrowed.first;
+		node->m_owner->release(borrowed.second);
+		// Columns changed again since have already been copied on, either to another store or back to their owner
+		if (node->m_store == this)
+			node->makeWritable();
+	}
+
+	m_borrowed.clear();
+}
+
+void ColumnStore::save(std::ostream& stream) const
+{
+	writeValue(stream, m_size);
+	writeValue(stream, m_wasted);
+	writeVector(stream, heights);
+#ifdef COMPACT_MARKERS
+	writeVector(stream, materials);
+	palette.save(stream);
+#else
+	writeVector(stream, resistiveForces);
+	writeVector(stream, fertilities);
+	writeVector(stream, sandAmounts);
+	writeVector(stream, clayAmounts);
+	writeVector(stream, colors);
+	writeVector(stream, hardStops);
+#endif
+	writeVector(stream, rockCounts);
+	writeVector(stream, soilSums);
+}
+
+bool ColumnStore::load(std::istream& stream)
+{
+	ColumnStore loaded;
+	bool read = readValue(stream, loaded.m_size) && readValue(stream, loaded.m_wasted) && readVector(stream, loaded.heights);
+#ifdef COMPACT_MARKERS
+	read = read && readVector(stream, loaded.materials) && loaded.palette.load(stream);
+	read = read && loaded.materials.size() == loaded.heights.size();
+#else
+	read = read && readVector(stream, loaded.resistiveForces) && readVector(stream, loaded.fertilities) && readVector(stream, loaded.sandAmounts)
+		&& readVector(stream, loaded.clayAmounts) && readVector(stream, loaded.colors) && readVector(stream, loaded.hardStops);
+	read = read && loaded.resistiveForces.size() == loaded.heights.size() && loaded.fertilities.size() == loaded.heights.size() && loaded.sandAmounts.size() == loaded.heights.size()
+		&& loaded.clayAmounts.size() == loaded.heights.size() && loaded.colors.size() == loaded.heights.size() && loaded.hardStops.size() == loaded.heights.size();
+#endif
+	read = read && readVector(stream, loaded.rockCounts) && readVector(stream, loaded.soilSums);
+	read = read && loaded.m_size >= 0 && loaded.heights.size() == (size_t)loaded.m_size && loaded.rockCounts.size() == (size_t)loaded.m_size
+		&& loaded.soilSums.size() == (size_t)(loaded.m_size + SOIL_SUM_STRIDE - 1) / SOIL_SUM_STRIDE;
+	if (!read)
+		return false;
+
+	*this = std::move(loaded);
+	return true;
+}
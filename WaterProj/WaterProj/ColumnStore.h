@@ -0,0 +1,246 @@
+#pragma once
+
+#include <glm.hpp>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+#include "MaterialPalette.h"
+
+class HaloGrid;
+class Node;
+class Subsurface;
+struct NodeMarker;
+
+// Spare markers left above each column when the store is compacted, so small deposits don't relocate it straight away
+#define COLUMN_HEADROOM 4
+// Soil totals are only kept for every this many markers of the store, with the few layers in between summed when needed
+#define SOIL_SUM_STRIDE 4
+// Store marker properties in a shared material palette, and water and vegetation data quantized, for large maps
+//#define COMPACT_MARKERS
+
+#ifdef COMPACT_MARKERS
+typedef unsigned short RockCount;
+// The most storing a marker can change each of its properties by, as listed on ColumnStore
+#define MARKER_RESIST_ERROR 0.002f
+#define MARKER_FRACTION_ERROR 0.002f
+#define MARKER_COLOR_ERROR 0.017f
+#else
+typedef int RockCount;
+#define MARKER_RESIST_ERROR 0.0f
+#define MARKER_FRACTION_ERROR 0.0f
+#define MARKER_COLOR_ERROR 0.0f
+#endif
+
+/***************************************************************************//**
+ * Running totals of the soil layers below a marker. Each layer is weighted by
+ * its thickness, so mixing everything between two markers is a subtraction.
+ ******************************************************************************/
+struct SoilSum
+{
+	float thickness = 0.0f;
+	float height = 0.0f;
+	float resistiveForce = 0.0f;
+	float fertility = 0.0f;
+	float sandAmount = 0.0f;
+	float clayAmount = 0.0f;
+	glm::vec3 color = glm::vec3(0.0f);
+
+	SoilSum operator-(const SoilSum& other) const
+	{
+		SoilSum diff;
+		diff.thickness = thickness - other.thickness;
+		diff.height = height - other.height;
+		diff.resistiveForce = resistiveForce - other.resistiveForce;
+		diff.fertility = fertility - other.fertility;
+		diff.sandAmount = sandAmount - other.sandAmount;
+		diff.clayAmount = clayAmount - other.clayAmount;
+		diff.color = color - other.color;
+		return diff;
+	}
+};
+
+/***************************************************************************//**
+ * Map-wide storage for the soil markers of every node. Each marker field is
+ * held in its own contiguous pool, and a node refers to its column by an
+ * offset and capacity within the pools rather than owning an allocation.
+ *
+ * Columns that outgrow their slot are moved to the end of the pools and the
+ * old slot is abandoned. Abandoned slots are reclaimed by compact().
+ *
+ * A store can be frozen for Map snapshots. Its columns are then shared
+ * between the map and its snapshots and forks, and each copies a column into
+ * its own store the first time it changes it.
+ *
+ * With COMPACT_MARKERS defined, a marker only holds its height and the index
+ * of its material within the store's palette, taking 6 bytes rather than 33.
+ * Properties are quantized to the palette's bins, giving errors of at most
+ * 0.002 in resistive force, fertility, sand and clay, and 0.017 in color.
+ * These only hold while the palette has room. MaterialPalette lists how far
+ * markers added once it's full can be out.
+ * Heights stay as floats, as erosion steps are far finer than 16 bits could
+ * hold over the height of a mountain.
+ ******************************************************************************/
+class ColumnStore
+{
+	friend class Node;
+public:
+	/***************************************************************************//**
+	 * Reserves pool memory ahead of time, to avoid regrowing pools during generation.
+	 @param markerCount The number of markers to reserve room for
+	 ******************************************************************************/
+	void reserve(int markerCount);
+	/***************************************************************************//**
+	 * Allocates a new column slot at the end of the pools.
+	 @param capacity The number of markers the slot can hold
+	 @return The offset of the new slot
+	 ******************************************************************************/
+	int allocate(int capacity);
+	/***************************************************************************//**
+	 * Marks a slot as abandoned. The space is reclaimed on the next compaction.
+	 @param capacity The capacity of the abandoned slot
+	 ******************************************************************************/
+	void release(int capacity);
+	/***************************************************************************//**
+	 * Gives every node an empty column, in node order. The same as attaching
+	 * each node in turn, but only resizes the pools once.
+	 @param nodes The nodes to give columns to
+	 @param count The number of nodes
+	 @param capacity The number of markers to make room for in each column
+	 ******************************************************************************/
+	void attach(Node* nodes, int count, int capacity);
+	NodeMarker get(int index) const;
+	void set(int index, const NodeMarker& marker);
+#ifdef COMPACT_MARKERS
+	float getResistiveForce(int index) const { return palette.get(materials[index]).resistiveForce; }
+	bool isHardStop(int index) const { return palette.get(materials[index]).hardStop; }
+	float getFertility(int index) const { return palette.get(materials[index]).fertility; }
+	float getSandAmount(int index) const { return palette.get(materials[index]).sandAmount; }
+	float getClayAmount(int index) const { return palette.get(materials[index]).clayAmount; }
+	glm::vec3 getColor(int index) const { return palette.get(materials[index]).color; }
+#else
+	float getResistiveForce(int index) const { return resistiveForces[index]; }
+	bool isHardStop(int index) const { return hardStops[index] != 0; }
+	float getFertility(int index) const { return fertilities[index]; }
+	float getSandAmount(int index) const { return sandAmounts[index]; }
+	float getClayAmount(int index) const { return clayAmounts[index]; }
+	glm::vec3 getColor(int index) const { return colors[index]; }
+#endif
+	/***************************************************************************//**
+	 * Changes the color and resistive force of a marker, keeping its other properties.
+	 @param index The index of the marker
+	 @param color The new color
+	 @param resistiveForce The new resistive force
+	 ******************************************************************************/
+	void setColorAndResistiveForce(int index, glm::vec3 color, float resistiveForce);
+	/***************************************************************************//**
+	 * Moves a run of markers within the pools. The source and destination may overlap.
+	 @param from The index of the first marker to move
+	 @param to The index to move the first marker to
+	 @param count The number of markers to move
+	 ******************************************************************************/
+	void move(int from, int to, int count);
+	/***************************************************************************//**
+	 * Slides every column belonging to this store down over abandoned slots,
+	 * leaving each with a little headroom where there is room for it.
+	 @param nodes The nodes that make up the map data
+	 @param count The number of nodes
+	 ******************************************************************************/
+	void compact(Node* nodes, int count);
+	/***************************************************************************//**
+	 * Moves every column of this store into a new frozen store, to be shared
+	 * with snapshots, and empties this one. Nodes keep reading from the frozen
+	 * store, and copy their column back into this one before changing it.
+	 @param nodes The nodes that make up the map data
+	 @param count The number of nodes
+	 @return The frozen store
+	 ******************************************************************************/
+	std::shared_ptr<ColumnStore> freeze(Node* nodes, int count);
+	/***************************************************************************//**
+	 * Sets what builds the layers the store's nodes left out, and where those
+	 * nodes are, so that nodes needn't each keep them. Kept when the store is
+	 * frozen, as its nodes still look to it.
+	 @param subsurface Generates the layers nodes left out
+	 @param nodes The nodes that make up the map data
+	 @param grid The grid over the nodes
+	 ******************************************************************************/
+	void setSubsurface(Subsurface* subsurface, const Node* nodes, const HaloGrid* grid);
+	Subsurface* getSubsurface() const { return m_subsurface; }
+	// The position on the map of one of the store's nodes
+	glm::ivec2 getPosition(const Node* node) const;
+	/***************************************************************************//**
+	 * Makes this the store every node copies its column into before changing it.
+	 * Used when nodes are restored from a snapshot, whose columns are all frozen.
+	 @param nodes The nodes that make up the map data
+	 @param count The number of nodes
+	 ******************************************************************************/
+	void adopt(Node* nodes, int count);
+	/***************************************************************************//**
+	 * Has the calling thread copy every column it changes into a store of its
+	 * own, rather than the store that owns the column, so that threads changing
+	 * separate parts of the map at once never allocate from the same store.
+	 @param store The store to copy columns into, or nullptr to go back to their owners
+	 ******************************************************************************/
+	static void redirect(ColumnStore* store);
+	static ColumnStore* getRedirect();
+	/***************************************************************************//**
+	 * Copies the columns still held by this store into the stores that own them,
+	 * and releases the slots they were copied out of. Columns can only be
+	 * borrowed by a store threads have been redirected to, and must be returned
+	 * once no threads are.
+	 ******************************************************************************/
+	void returnColumns();
+	/***************************************************************************//**
+	 * Writes the pools to a binary stream, as they're laid out in memory.
+	 @param stream The stream to write to
+	 ******************************************************************************/
+	void save(std::ostream& stream) const;
+	/***************************************************************************//**
+	 * Replaces the pools with ones written by save. Nodes still have to be
+	 * pointed at the store, as their columns are only offsets within it.
+	 @param stream The stream to read from
+	 @return Whether the pools were read whole
+	 ******************************************************************************/
+	bool load(std::istream& stream);
+	/***************************************************************************//**
+	 * Whether enough of the pools have been abandoned to make compacting worthwhile.
+	 ******************************************************************************/
+	bool shouldCompact() const { return m_wasted > (m_size - m_wasted) / 2; }
+	int getSize() const { return m_size; }
+	/***************************************************************************//**
+	 * The memory taken by each marker slot across all pools, in bytes.
+	 ******************************************************************************/
+	static float bytesPerMarker();
+	int getWasted() const { return m_wasted; }
+
+	std::vector<float> heights;
+#ifdef COMPACT_MARKERS
+	// Indices into the palette
+	std::vector<unsigned short> materials;
+	MaterialPalette palette;
+#else
+	std::vector<float> resistiveForces;
+	std::vector<float> fertilities;
+	std::vector<float> sandAmounts;
+	std::vector<float> clayAmounts;
+	std::vector<glm::vec3> colors;
+	std::vector<char> hardStops;
+#endif
+	// The number of hard stops at or below each marker within its column, so rock state can be found without walking the column
+	std::vector<RockCount> rockCounts;
+	// Totals of the soil layers strictly below every SOIL_SUM_STRIDE'th marker of the store, leaving out rock.
+	// These aren't moved along with markers, so a column has to be re-indexed after it moves.
+	std::vector<SoilSum> soilSums;
+
+protected:
+	void resize(int size);
+
+	int m_size = 0;
+	int m_wasted = 0;
+	// Nodes whose columns were copied into this store by redirected threads, with the capacity each left behind in its owner
+	std::vector<std::pair<Node*, int>> m_borrowed;
+	// What builds the layers the nodes owned by the store left out, and where they are
+	Subsurface* m_subsurface = nullptr;
+	const Node* m_nodes = nullptr;
+	const HaloGrid* m_grid = nullptr;
+};
@@ -0,0 +1,108 @@
+#include "Depressions.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "FloodFill.h"
+#include "HaloGrid.h"
+#include "Node.h"
+
+void Depressions::build(const Node* nodes, const HaloGrid* grid)
+{
+	const glm::ivec2 dim = grid->getDimensions();
+	m_grid = grid;
+	m_spill.assign(dim.x * dim.y, 0.0f);
+	m_route.assign(dim.x * dim.y, -1);
+	m_basin.assign(dim.x * dim.y, -1);
+	m_basins.clear();
+	std::vector<bool> reached(dim.x * dim.y, false);
+	// The basin spilling over each drain
+	std::vector<int> drained(dim.x * dim.y, -1);
+
+	// Nodes by spill height and then index, as a min-heap, starting from those round the edge
+	std::vector<std::pair<float, int>> queue;
+	auto push = [&](int index, float spill, int route)
+	{
+		reached[index] = true;
+		m_spill[index] = spill;
+		m_route[index] = route;
+		queue.push_back(std::make_pair(spill, index));
+		std::push_heap(queue.begin(), queue.end(), std::greater<std::pair<float, int>>());
+
+		// A node below its spill height is in the basin of the node it was reached from, or starts one spilling over that node
+		const float depth = spill - nodes[index].waterHeight();
+		if (depth <= FLOOD_LEVEL_TOLERANCE)
+			return;
+
+		int basin = m_basin[route];
+		if (basin < 0)
+		{
+			// Every node below the spill height around a drain fills to it, so they're one basin
+			if (drained[route] < 0)
+			{
+				drained[route] = (int)m_basins.size();
+				m_basins.push_back(Basin());
+				m_basins.back().drain = route;
+				m_basins.back().spill = spill;
+			}
+			basin = drained[route];
+		}
+		m_basin[index] = basin;
+		m_basins[basin].capacity += depth;
+	};
+
+	for (int y = 0; y < dim.y; ++y)
+	{
+		for (int x = 0; x < dim.x; ++x)
+		{
+			if (x == 0 || y == 0 || x == dim.x - 1 || y == dim.y - 1)
+			{
+				const int index = grid->index(x, y);
+				push(index, nodes[index].waterHeight(), -1);
+			}
+		}
+	}
+
+	// Water on a node runs off through the lowest neighbour it can, once it's risen to that neighbour's spill height
+	while (!queue.empty())
+	{
+		std::pop_heap(queue.begin(), queue.end(), std::greater<std::pair<float, int>>());
+		const std::pair<float, int> next = queue.back();
+		queue.pop_back();
+
+		const glm::ivec2 pos = grid->position(next.second);
+		for (int y = glm::max(pos.y - 1, 0); y <= glm::min(pos.y + 1, dim.y - 1); ++y)
+		{
+			for (int x = glm::max(pos.x - 1, 0); x <= glm::min(pos.x + 1, dim.x - 1); ++x)
+			{
+				const int neighbour = grid->index(x, y);
+				if (!reached[neighbour])
+					push(neighbour, glm::max(nodes[neighbour].waterHeight(), next.first), next.second);
+			}
+		}
+	}
+}
+
+bool Depressions::runsOff(const Node* nodes, int index, glm::ivec4 area) const
+{
+	// Nodes that were in a depression are left for the flood to look at, since they most likely still are
+	float height = nodes[index].waterHeight();
+	if (m_spill[index] > height + FLOOD_LEVEL_TOLERANCE)
+		return false;
+
+	// Water only follows the route if it never has to rise, so that nothing along the way would catch it first
+	for (int current = m_route[index]; current >= 0; current = m_route[current])
+	{
+		const glm::ivec2 pos = m_grid->position(current);
+		if (pos.x < area.x || pos.y < area.y || pos.x >= area.z || pos.y >= area.w)
+			return false;
+
+		const float next = nodes[current].waterHeight();
+		if (next > height + FLOOD_LEVEL_TOLERANCE)
+			return false;
+		height = glm::min(height, next);
+	}
+
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm.hpp>
+#include <vector>
+
+class HaloGrid;
+class Node;
+
+/***************************************************************************//**
+ * A depression water standing in has to fill before it can run off the map.
+ ******************************************************************************/
+struct Basin
+{
+	// The node the water spills out of the basin through, on its way off the map
+	int drain = -1;
+	// The height the water has to rise to before it spills
+	float spill = 0.0f;
+	// The water the basin holds once it's filled to its spill height
+	float capacity = 0.0f;
+};
+
+/***************************************************************************//**
+ * The depressions in the water surface of the map, and the routes water takes
+ * out of them to the edge of the map. Found by flooding the surface in from
+ * the edge of the map, lowest node first, so every node gets the height water
+ * standing on it has to rise to before it can run off the map, and the next
+ * node on its way there.
+ *
+ * Nodes whose spill height is above their water are grouped into basins,
+ * one for each node water spills over out of them. Basins nested inside a
+ * bigger one are part of it, as they fill before it spills.
+ *
+ * Found once and then read while the surface changes under it. Spill heights
+ * and basins are only a guide after that, but routes are checked against the
+ * current heights before they're trusted, so answers about them are always
+ * right. They may just miss routes that opened up after the map was flooded.
+ ******************************************************************************/
+class Depressions
+{
+public:
+	/***************************************************************************//**
+	 * Floods the water surface of the map in from its edge.
+	 @param nodes The nodes of the map
+	 @param grid The grid over the nodes
+	 ******************************************************************************/
+	void build(const Node* nodes, const HaloGrid* grid);
+	/***************************************************************************//**
+	 * Whether water standing on a node runs off the edge of the map, that is
+	 * whether its route there never rises above it. The route is only followed
+	 * within an area, so it can be checked while the rest of the map changes.
+	 @param nodes The nodes of the map
+	 @param index The index of the node
+	 @param area The corners of the area to follow the route within, with the far corner just outside it
+	 @return Whether the water runs off, or false if the route leaves the area first
+	 ******************************************************************************/
+	bool runsOff(const Node* nodes, int index, glm::ivec4 area) const;
+	// The height water on a node had to rise to before it could run off the map, when the map was flooded
+	float getSpillHeight(int index) const { return m_spill[index]; }
+	// The basin a node was in when the map was flooded, or -1 if water on it ran straight off
+	int getBasin(int index) const { return m_basin[index]; }
+	// The node water spills out of a basin through
+	int getDrain(int basin) const { return m_basins[basin].drain; }
+	// The height a basin fills to before it spills
+	float getBasinSpillHeight(int basin) const { return m_basins[basin].spill; }
+	// The water a basin held below its spill height, when the map was flooded
+	float getCapacity(int basin) const { return m_basins[basin].capacity; }
+	int getBasinCount() const { return (int)m_basins.size(); }
+
+protected:
+	const HaloGrid* m_grid = nullptr;
+	std::vector<float> m_spill;
+	// The next node on the way to the edge of the map from each node, or -1 for nodes on the edge
+	std::vector<int> m_route;
+	// The basin each node is in, or -1
+	std::vector<int> m_basin;
+	std::vector<Basin> m_basins;
+};
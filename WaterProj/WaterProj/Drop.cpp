@@ -1,8 +1,10 @@
 ﻿#include "Drop.h"
 
 #include <iostream>
-#include <stack>
 
+#include "Depressions.h"
+#include "FloodFill.h"
+#include "Lakes.h"
 #include "Map.h"
 
 Drop::Drop(glm::vec2 pos, MapParams* params) 
@@ -19,9 +21,9 @@ Drop::Drop(glm::vec2 pos, float volume, MapParams* params)
     m_volume = volume;
 }
 
-void Drop::cascade(glm::vec2 pos, glm::ivec2 dim, Node* nodes, bool* track, float& maxHeight)
+void Drop::cascade(glm::vec2 pos, const HaloGrid& grid, Node* nodes, bool* track, float& maxHeight)
 {
-    int ind = floor(pos.y) * dim.x + floor(pos.x);
+    int ind = grid.index((int)pos.x, (int)pos.y);
 
     // Don't simulate transfer if we're stuck on one tile
     if (m_prevIndex == ind)
@@ -37,16 +39,16 @@ void Drop::cascade(glm::vec2 pos, glm::ivec2 dim, Node* nodes, bool* track, floa
 
     deposit = glm::min(m_params->dropSedimentDepositCap, deposit);
 
-    // For each neighboring node
-    const int nx[8] = { -1,-1,-1, 0, 0, 1, 1, 1 };
-    const int ny[8] = { -1, 0, 1,-1, 1,-1, 0, 1 };
+    // For each neighboring node, with those off the map left out by the halo
+    const int center = grid.haloIndex((int)pos.x, (int)pos.y);
+    const int stride = grid.getStride();
+    const int offsets[8] = { -stride - 1, -1, stride - 1, -stride, stride, -stride + 1, 1, stride + 1 };
 
     for (int i = 0; i < 8; i++) 
     {
-        glm::ivec2 offsetPos = (glm::ivec2)pos + glm::ivec2(nx[i], ny[i]);
-        int offsetIndex = offsetPos.y * dim.x + offsetPos.x;
+        int offsetIndex = grid.entry(center + offsets[i]);
 
-        if (offsetPos.x >= dim.x || offsetPos.y >= dim.y || offsetPos.x < 0 || offsetPos.y < 0)
+        if (!HaloGrid::isInside(offsetIndex))
             continue;
 
         if (offsetIndex == m_prevIndex)
@@ -66,7 +68,7 @@ void Drop::cascade(glm::vec2 pos, glm::ivec2 dim, Node* nodes, bool* track, floa
 
         // Van Rijn calculations for sediment transfer
         // Cohesionless and size assumed to be similar to dirt/sand (30000 microns)
-        float transportRate = pow(actingForce * pow((nodes[ind].top()->resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
+        float transportRate = pow(actingForce * pow((nodes[ind].top().resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
         float transfer = actingForce * transportRate;
         // Modify based on height difference, to account for exposed amount of surface
         transfer *= glm::max(1.0f, (1.5f - diff));
@@ -75,15 +77,20 @@ void Drop::cascade(glm::vec2 pos, glm::ivec2 dim, Node* nodes, bool* track, floa
         m_sediment.mix(nodes[ind].getDataAboveHeight(nodes[ind].topHeight() - transfer), glm::max(0.0f, glm::min(1.0f, transfer / m_sedimentAmount)));
 
         nodes[ind].setHeight(nodes[ind].topHeight() - transfer, m_sediment, maxHeight);
+        if (m_lowered.empty() || m_lowered.back() != ind)
+            m_lowered.push_back(ind);
 
         m_sedimentAmount -= deposit;
 
-        if(!nodes[offsetIndex].hasWater())
+        if (!nodes[offsetIndex].hasWater())
+        {
             nodes[offsetIndex].setHeight(nodes[offsetIndex].topHeight() + deposit, m_sediment, maxHeight);
+            m_raised.push_back(offsetIndex);
+        }
     }
 }
 
-bool Drop::descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, float& maxHeight) 
+bool Drop::descend(glm::vec3 norm, Node* nodes, const HaloGrid& grid, bool* track, float& maxHeight) 
 {
     // Simulate behavior as a particle running down the landscape
     if (m_terminated)
@@ -93,23 +100,25 @@ bool Drop::descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, flo
         return false;
 
     m_lastVelocity = m_velocity;
-    int index = (int)m_pos.y * dim.x + (int)m_pos.x;
-
-    if (index < 0 || index >= dim.x * dim.y)
+    if (!grid.contains(m_pos))
         return false;
 
+    int index = grid.index((int)m_pos.x, (int)m_pos.y);
+
     nodes[index].setParticles(nodes[index].getParticles() + m_volume);
 
-    // Likely to flow into other water
+    // Likely to flow into other water. Neighbours off the map have none.
+    const int center = grid.haloIndex((int)m_pos.x, (int)m_pos.y);
+    auto particlesAt = [&](int haloIndex)
+    {
+        const int entry = grid.entry(haloIndex);
+        return HaloGrid::isInside(entry) ? nodes[entry].getParticles() : 0.0f;
+    };
     glm::vec2 particleEffect(0.0f);
-    if(index - dim.x > 0)
-        particleEffect.y -= nodes[index - dim.x].getParticles();
-    if (index + dim.x < dim.x * dim.y)
-        particleEffect.y += nodes[index + dim.x].getParticles();
-    if(index - 1 > 0)
-        particleEffect.x -= nodes[index - 1].getParticles();
-    if (index + 1 < dim.x * dim.y)
-        particleEffect.x += nodes[index + 1].getParticles();
+    particleEffect.y -= particlesAt(center - grid.getStride());
+    particleEffect.y += particlesAt(center + grid.getStride());
+    particleEffect.x -= particlesAt(center - 1);
+    particleEffect.x += particlesAt(center + 1);
 
     // θ can be found with dot product
     float theta = acos(glm::dot(norm, glm::vec3(0.0f, 1.0f, 0.0f)));
@@ -138,7 +147,7 @@ bool Drop::descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, flo
     // We need to visit every possible square, so normalize velocity only for movement. This won't matter as we immediately simulate again and will keep moving!
     m_pos += glm::normalize(m_velocity) * (float)sqrt(2);
 
-    if (m_pos.x < 0 || m_pos.x >= dim.x || m_pos.y < 0 || m_pos.y >= dim.y)
+    if (!grid.contains(m_pos))
         return false;
 
     m_volume *= m_params->particleEvaporationRate;
@@ -149,7 +158,7 @@ bool Drop::descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, flo
     {
         glm::ivec2 prev = m_previous.front();
 
-        if (distance(m_previous.front(), m_pos) < m_params->particleTerminationProximity || nodes[prev.y * dim.x + prev.x].hasWater())
+        if (distance(m_previous.front(), m_pos) < m_params->particleTerminationProximity || nodes[grid.index(prev.x, prev.y)].hasWater())
             m_terminated = true;
        
         m_previous.pop();
@@ -157,181 +166,101 @@ bool Drop::descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, flo
 
     m_previous.push(m_pos);
 
-    cascade(m_pos, dim, nodes, track, maxHeight);
+    cascade(m_pos, grid, nodes, track, maxHeight);
     m_prevIndex = index;
     return true;
 }
 
-bool Drop::flood(Node* nodes, glm::ivec2 dim, float& maxHeight) 
+bool Drop::flood(Node* nodes, const HaloGrid& grid, float& maxHeight, FloodFill& fill, const Depressions& depressions, Lakes& lakes) 
 {
-    float increaseAmount = m_params->floodDefaultIncrease;
+    reportChanges(lakes, fill.getArea());
     while (m_volume > m_params->dropMinimumVolume)
     {
-        int index = (int)m_pos.y * dim.x + (int)m_pos.x;
-        if (index < 0 || index >= dim.x * dim.y)
+        if (!grid.contains(m_pos))
             return false;
-        float plane = nodes[index].waterHeight() + increaseAmount;
+        int index = grid.index((int)m_pos.x, (int)m_pos.y);
 
-        std::stack<int> toTry;
-        std::vector<int> set;
-        std::vector<int> border;
-        const int size = (int)dim.x * dim.y;
-        bool* tried = new bool[size];
-        bool offMap = false;
-
-        std::fill(tried, tried + size, false);
-
-        std::function<bool(int)> inBounds = [&](int i)
+        // We've reached water that's already running off the map, so go with it
+        if (nodes[index].hasWater() && depressions.runsOff(nodes, index, fill.getArea()))
         {
-            if (i < 0 || i >= size)
-            {
-                offMap = true;
-                return false;
-            }
+            m_volume = 0.0f;
+            break;
+        }
 
-            if (tried[i])
-                return false;
+        // We've reached a lake with room for us, so settle straight into it
+        int lake = lakes.find(index, fill.getArea());
+        if (lake >= 0 && lakes.canHold(lake, m_volume))
+        {
+#ifdef WATERDEBUG
+            std::cout << "adding to lake of " << lakes.getCells(lake).size() << " nodes at " << m_pos.x << ", " << m_pos.y << std::endl;
+#endif // WATERDEBUG
+            transportThroughPool(nodes, &lakes.getCells(lake), maxHeight);
+            lakes.add(nodes, lake, m_volume);
+            m_volume = 0.0f;
+            break;
+        }
 
-            tried[i] = true;
+        float plane = fill.pour(nodes, glm::ivec2(m_pos), m_volume);
 
+        // Nothing has been changed by this pour yet, so it can be taken again from the start
+        if (fill.reachedBounds())
             return true;
-        };
 
-        std::function<void(int, float&)> fill = [&](int i, float& vol) 
+        const std::vector<int>& set = fill.getSet();
+        int drain = fill.getDrain();
+        if (drain == index)
         {
-            if (plane < nodes[i].waterHeight()) {
-                border.push_back(i);
-                return;
-            }
-
-            set.push_back(i);
-            vol += glm::max(0.0f, plane - nodes[i].waterHeight());
-
-            if (inBounds(i + dim.x))
-                toTry.push(i + dim.x);
-            if (inBounds(i - dim.x))
-                toTry.push(i - dim.x);
-            if (inBounds(i + 1))
-                toTry.push(i + 1);
-            if (inBounds(i - 1))
-                toTry.push(i - 1);
-            if (inBounds(i + dim.x + 1))
-                toTry.push(i + dim.x + 1);
-            if (inBounds(i - dim.x - 1))
-                toTry.push(i - dim.x - 1);
-            if (inBounds(i + dim.x - 1))
-                toTry.push(i + dim.x - 1);
-            if (inBounds(i - dim.x + 1))
-                toTry.push(i - dim.x + 1);
-        };
-
-        if (inBounds(index))
-            toTry.push(index);
-        else
-            break;
+            // The water spills before it can rise at all, so run on to where it spills to and pour again there
+            m_pos = glm::vec2(grid.position(fill.getOutflow()));
+            continue;
+        }
 
-        float currVolume = 0.0f;
-        while (!toTry.empty())
+        if (set.size() <= 1)
         {
-            if (currVolume > m_volume)
-                break;
-
-            int current = toTry.top();
-            toTry.pop();
-            fill(current, currVolume);
+            // Evaporate as nothing else can happen here- we can't fill anything at all
+            m_volume = 0.0f;
+            break;
         }
 
-        if (set.size() > 1 && currVolume != 0.0f && currVolume < m_volume)
-        {
 #ifdef WATERDEBUG
-            std::cout << "flooding set of " << set.size() << " nodes at " << m_pos.x << ", " << m_pos.y << " to height " << plane << std::endl;
+        std::cout << "flooding set of " << set.size() << " nodes at " << m_pos.x << ", " << m_pos.y << " to height " << plane << std::endl;
 #endif // WATERDEBUG
-            m_volume -= currVolume;
-
-            transportThroughPool(nodes, dim, &set, maxHeight);
-            for (int s : set)
-            {
-                nodes[s].setWaterHeight(plane);
-            }
+        transportThroughPool(nodes, &set, maxHeight);
+        m_volume -= fill.getVolume();
+        for (int s : set)
+        {
+            nodes[s].setWaterHeight(plane);
         }
-        else if(set.size() > 1)
+
+        // All the water settled in the pool, which is kept for the next drops to reach it
+        if (drain < 0 && !fill.reachedEdge())
         {
-            // Not a parameter, as changing this can really impact performance
-            if (increaseAmount >= 0.00001f)
-            {
-                increaseAmount /= 10.0f;
-                continue;
-            }
-
-            if (!nodes[index].hasWater())
-                break;
-
-            set.clear();
-            border.clear();
-            toTry.push(index); 
-            std::fill(tried, tried + size, false);
-            currVolume = 0.0f;
-            offMap = false;
-            plane = nodes[index].waterHeight();
-            while (!toTry.empty())
-            {
-                int current = toTry.top();
-                toTry.pop();
-                fill(current, currVolume);
-            }
-
-            if (!offMap)
-            {
-                int drain = 0;
-                float drainHeight = FLT_MAX;
-                for (int potentialDrain : border)
-                {
-                    float height = nodes[drain].waterHeight();
-                    if (height < drainHeight)
-                    {
-                        drain = potentialDrain;
-                        drainHeight = height;
-                    }
-                }
-
-                glm::vec2 drainPos = glm::vec2(drain % dim.x, drain / dim.x);
-                if (m_pos == drainPos)
-                {
-                    nodes[drain].erodeByValue(m_params->drainErosionAmount);
-                    break;
-                }
-
-                transportThroughPool(nodes, dim, &set, maxHeight);
-
-                for (int s : set)
-                {
-                    nodes[s].setWaterHeight(plane);
-                }
-
-                m_pos = drainPos;
-                m_terminated = false;
-            }
-            else
-            {
-                // We're going to fill off the map, so "evaporate" and vanish
-                m_volume = 0.0f;
-            }
-#ifdef WATERDEBUG
-            std::cout << "overflowing particle from set of " << set.size() << "nodes at " << m_pos.x << ", " << m_pos.y << ". plane = " << plane << " drain = " << drainHeight << std::endl;
-#endif // WATERDEBUG
+            lakes.settle(nodes, set, fill.getShore(), plane, fill.getArea());
+            break;
         }
-        else
+
+        // The lakes the pool rose over aren't level any more
+        for (int s : set)
+            lakes.forget(s, fill.getArea());
+
+        if (fill.reachedEdge())
         {
-            // Evaporate as nothing else can happen here- we can't fill anything at all
+            // We're going to fill off the map, so "evaporate" and vanish
             m_volume = 0.0f;
+            break;
         }
 
-        delete[] tried;
+        // The pool is full, so the rest runs out over its lowest edge
+        m_pos = glm::vec2(grid.position(fill.getOutflow()));
+        m_terminated = false;
+#ifdef WATERDEBUG
+        std::cout << "overflowing particle from set of " << set.size() << "nodes at " << m_pos.x << ", " << m_pos.y << ". plane = " << plane << std::endl;
+#endif // WATERDEBUG
     }
     return false;
 }
 
-void Drop::transportThroughPool(Node* nodes, glm::vec2 dim, std::vector<int>* set, float& maxHeight)
+void Drop::transportThroughPool(Node* nodes, const std::vector<int>* set, float& maxHeight)
 {
 #ifdef WATERDEBUG
     std::cout << "mixing sediment in pool of size " << set->size() << std::endl;
@@ -345,9 +274,9 @@ void Drop::transportThroughPool(Node* nodes, glm::vec2 dim, std::vector<int>* se
     // Collect sediment from all areas of the pool
     for (int s : *set)
     {
-        if (nodes[s].top()->resistiveForce < 10.0f)
+        if (nodes[s].top().resistiveForce < 10.0f)
         {
-            float transfer = m_volume * pow(m_volume * pow((nodes[s].top()->resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
+            float transfer = m_volume * pow(m_volume * pow((nodes[s].top().resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
             sedimentAmount += transfer;
             sediment.mix(nodes[s].getDataAboveHeight(nodes[s].topHeight() - transfer, true), transfer / sedimentAmount);
         }
@@ -362,16 +291,27 @@ void Drop::transportThroughPool(Node* nodes, glm::vec2 dim, std::vector<int>* se
     // Deposit sediment based on existing height + pickup rate
     for (int s : *set)
     {
-        if (nodes[s].top()->resistiveForce < 10.0f)
+        if (nodes[s].top().resistiveForce < 10.0f)
         {
             float topHeight = nodes[s].topHeight();
-            float transfer = m_volume * pow(m_volume * pow((nodes[s].top()->resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
+            float transfer = m_volume * pow(m_volume * pow((nodes[s].top().resistiveForce - 1) * 0.02943f, -0.5f), 2.4f) * 0.0027507f;
             nodes[s].erodeByValue(transfer);
             nodes[s].setHeight(topHeight, sediment, maxHeight);
         }
     }
 }
 
+void Drop::reportChanges(Lakes& lakes, glm::ivec4 area)
+{
+    // Nodes around a lowered node may have held it in as part of a lake's shore
+    for (int index : m_lowered)
+        lakes.forgetAround(index, area);
+    for (int index : m_raised)
+        lakes.forget(index, area);
+    m_lowered.clear();
+    m_raised.clear();
+}
+
 float Drop::getMinVolume()
 {
     return m_params->dropMinimumVolume;
@@ -3,12 +3,16 @@
 #include <queue>
 #include <unordered_map>
 
+#include "HaloGrid.h"
 #include "Node.h"
 
 // Resolves conflict between GLM and windows defines
 #define NOMINMAX
 //#define WATERDEBUG
 
+class Depressions;
+class FloodFill;
+class Lakes;
 class MapParams;
 
 /***************************************************************************//**
@@ -42,36 +46,47 @@ public:
      * gravitational calculations needed for simulation
      * @param norm The normal of the current tile
      * @param nodes Pointer to the node array that makes up the map
+     * @param grid The halo grid over the node array, for neighbour lookups
      * @param track A series of flags to allow particle movement to be tracked by the map
-     * @param dim The dimesions of the map
      * @param maxHeight The maximum height of the map
      ******************************************************************************/
-    bool descend(glm::vec3 norm, Node* nodes, bool* track, glm::ivec2 dim, float& maxHeight);
+    bool descend(glm::vec3 norm, Node* nodes, const HaloGrid& grid, bool* track, float& maxHeight);
     /***************************************************************************//**
      * Flood simulation for a particle, attempting to join or create a pool
      * @param nodes Pointer to the node array that makes up the map
-     * @param dim The dimesions of the map
+     * @param grid The halo grid over the node array, for neighbour lookups
      * @param maxHeight The maximum height of the map
+     * @param fill The flood fill to find pools with, which keeps them within its area
+     * @param depressions The depressions of the map, to find water that runs off it without filling pools
+     * @param lakes The lakes drops have settled in, to add to without filling them again
+     * @return Whether a pool reached past the fill's area, leaving the flood to be finished with a larger one
      ******************************************************************************/
-    bool flood(Node* nodes, glm::ivec2 dim, float& maxHeight);
+    bool flood(Node* nodes, const HaloGrid& grid, float& maxHeight, FloodFill& fill, const Depressions& depressions, Lakes& lakes);
     /***************************************************************************//**
      * Cascading for a particle, picking up and depositing sediment after a descent.
      * @param pos The position of the particle
-     * @param dim The dimesions of the map
+     * @param grid The halo grid over the node array, for neighbour lookups
      * @param nodes Pointer to the node array that makes up the map
      * @param track A series of flags to allow particle movement to be tracked by the map
      * @param maxHeight The maximum height of the map
      ******************************************************************************/
-    void cascade(glm::vec2 pos, glm::ivec2 dim, Node* nodes, bool* track, float& maxHeight);
+    void cascade(glm::vec2 pos, const HaloGrid& grid, Node* nodes, bool* track, float& maxHeight);
     /***************************************************************************//**
      * Transporting sediment through a defined pool. This will evenly mix all top value
      * sediment within the given set, and deposit it accordingly.
      * @param nodes Pointer to the node array that makes up the map
-     * @param dim The dimesions of the map
-     * @param set A set of index values for nodes within the pool, to have their sediment mixed
+     * @param set A set of index values for nodes within the pool or lake, to have their sediment mixed
      * @param maxHeight The maximum height of the map
      ******************************************************************************/
-    void transportThroughPool(Node* nodes, glm::vec2 dim, std::vector<int>* set, float& maxHeight);
+    void transportThroughPool(Node* nodes, const std::vector<int>* set, float& maxHeight);
+    /***************************************************************************//**
+     * Tells the lakes about the nodes the drop has raised or lowered since it
+     * last did, so the lakes they're in or around are forgotten. Must be called
+     * before anything else reads the lakes.
+     * @param lakes The lakes drops have settled in
+     * @param area The corners of the area the drop has been changing, with the far corner just outside it
+     ******************************************************************************/
+    void reportChanges(Lakes& lakes, glm::ivec4 area);
 
     glm::vec2 getPosition() { return m_pos; }
     float getVolume() { return m_volume; }
@@ -91,6 +106,9 @@ protected:
     float m_sedimentAmount = 0.0f;
     NodeMarker m_sediment;
     MapParams* m_params;
+    // Nodes the drop has lowered and raised, that the lakes haven't been told about yet
+    std::vector<int> m_lowered;
+    std::vector<int> m_raised;
 
     bool m_terminated = false;
 };
\ No newline at end of file
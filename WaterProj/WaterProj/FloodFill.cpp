@@ -0,0 +1,126 @@
+#include "FloodFill.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "HaloGrid.h"
+#include "Node.h"
+
+void FloodFill::setArea(const HaloGrid* grid, glm::ivec4 area)
+{
+	const glm::ivec2 dim = grid->getDimensions();
+	m_grid = grid;
+	m_area = glm::ivec4(glm::max(glm::ivec2(area.x, area.y), glm::ivec2(0)), glm::min(glm::ivec2(area.z, area.w), dim));
+
+	// Stamps left from earlier pours are all older than those to come, so they needn't be cleared when the area moves
+	const size_t size = (size_t)glm::max(0, m_area.z - m_area.x) * glm::max(0, m_area.w - m_area.y);
+	if (m_visits.size() < size)
+		m_visits.resize(size, 0);
+}
+
+float FloodFill::pour(const Node* nodes, glm::ivec2 start, float volume)
+{
+	// A new stamp leaves every node unvisited. The stamps only have to be cleared when they run out.
+	if (++m_fill == 0)
+	{
+		std::fill(m_visits.begin(), m_visits.end(), 0);
+		m_fill = 1;
+	}
+
+	m_queue.clear();
+	m_set.clear();
+	m_drain = -1;
+	m_outflow = -1;
+	m_reachedEdge = false;
+	m_reachedBounds = false;
+	m_volume = 0.0f;
+
+	if (start.x < m_area.x || start.y < m_area.y || start.x >= m_area.z || start.y >= m_area.w)
+	{
+		m_reachedBounds = true;
+		return 0.0f;
+	}
+
+	const int startIndex = m_grid->index(start.x, start.y);
+	float plane = nodes[startIndex].waterHeight();
+	float remaining = volume;
+	// The node that last raised the surface, which the pool spills over if it finds a way down
+	int rim = startIndex;
+
+	m_visits[(start.y - m_area.y) * (m_area.z - m_area.x) + start.x - m_area.x] = m_fill;
+	m_queue.push_back(std::make_pair(plane, startIndex));
+	while (!m_queue.empty())
+	{
+		std::pop_heap(m_queue.begin(), m_queue.end(), std::greater<std::pair<float, int>>());
+		const std::pair<float, int> next = m_queue.back();
+		m_queue.pop_back();
+
+		if (next.first < plane - FLOOD_LEVEL_TOLERANCE)
+		{
+			m_drain = rim;
+			m_outflow = next.second;
+			break;
+		}
+
+		// Raise the whole pool to the next node, unless the water runs out on the way
+		if (next.first > plane)
+		{
+			const float needed = (next.first - plane) * m_set.size();
+			if (needed >= remaining)
+			{
+				plane += remaining / m_set.size();
+				remaining = 0.0f;
+				// The node the water ran out at is still around the pool, so goes back with the others
+				m_queue.push_back(next);
+				break;
+			}
+
+			remaining -= needed;
+			plane = next.first;
+			rim = next.second;
+		}
+
+		if (!take(nodes, next.second))
+			break;
+	}
+
+	m_volume = volume - remaining;
+	return plane;
+}
+
+bool FloodFill::take(const Node* nodes, int index)
+{
+	const glm::ivec2 dim = m_grid->getDimensions();
+	const glm::ivec2 pos = m_grid->position(index);
+	m_set.push_back(index);
+
+	for (int y = pos.y - 1; y <= pos.y + 1; ++y)
+	{
+		for (int x = pos.x - 1; x <= pos.x + 1; ++x)
+		{
+			if (x < 0 || y < 0 || x >= dim.x || y >= dim.y)
+			{
+				m_reachedEdge = true;
+				return false;
+			}
+
+			// Nodes outside the area may be changing under another pour, so they can't even be looked at
+			if (x < m_area.x || y < m_area.y || x >= m_area.z || y >= m_area.w)
+			{
+				m_reachedBounds = true;
+				return false;
+			}
+
+			unsigned int& visit = m_visits[(y - m_area.y) * (m_area.z - m_area.x) + x - m_area.x];
+			if (visit == m_fill)
+				continue;
+
+			visit = m_fill;
+			const int neighbour = m_grid->index(x, y);
+			m_queue.push_back(std::make_pair(nodes[neighbour].waterHeight(), neighbour));
+			std::push_heap(m_queue.begin(), m_queue.end(), std::greater<std::pair<float, int>>());
+		}
+	}
+
+	return true;
+}
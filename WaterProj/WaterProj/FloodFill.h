@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glm.hpp>
+#include <utility>
+#include <vector>
+
+class HaloGrid;
+class Node;
+
+// Nodes this little under a pool's surface are taken as level with it, so that rounding in the water heights stored
+// for a pool doesn't look like somewhere for it to spill
+#define FLOOD_LEVEL_TOLERANCE 0.0001f
+
+/***************************************************************************//**
+ * Finds the pools drops flood. Water poured onto a node spreads out through
+ * the nodes around it, including diagonally, lowest first. The pool's surface
+ * rises to each node it takes in, until the water runs out or the pool reaches
+ * a node lower than its surface, where it spills over.
+ *
+ * The nodes the pool could spread to next are kept in a priority queue, so a
+ * pool is found in one pass however deep it fills. Nodes are marked as visited
+ * with a stamp that changes for every pour, so the workspace is kept between
+ * pours rather than cleared or allocated for each one.
+ *
+ * Pours are kept within an area of the grid, so a pour for one part of the map
+ * doesn't read another. A pool reaching the edge of the area is noted and left
+ * unfinished. A pool reaching the edge of the map runs off it, so it stops
+ * rising there, and is noted.
+ ******************************************************************************/
+class FloodFill
+{
+public:
+	/***************************************************************************//**
+	 * Sets the area pours are kept within, and makes room to mark it. The
+	 * workspace is only reallocated if the area is bigger than it has been.
+	 @param grid The grid over the nodes to fill
+	 @param area The corners of the area, with the far corner just outside it. Clipped to the grid.
+	 ******************************************************************************/
+	void setArea(const HaloGrid* grid, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Pours water onto a node and finds the pool it settles into. Nodes are
+	 * added to the pool lowest first, starting with the node poured onto.
+	 @param nodes The nodes to fill
+	 @param start The position to pour onto
+	 @param volume The water to pour
+	 @return The height of the pool's surface
+	 ******************************************************************************/
+	float pour(const Node* nodes, glm::ivec2 start, float volume);
+	// The indices of the nodes in the pool. Nodes level with its surface may be included.
+	const std::vector<int>& getSet() const { return m_set; }
+	// The water taken to fill the pool. Less than was poured if it spilled or ran off the map.
+	float getVolume() const { return m_volume; }
+	// The index of the node the pool spills over, at the height of its surface, or -1 if it didn't spill. This is the
+	// start if the pool never rose, including when it spread across level water and spilled some way from the start.
+	int getDrain() const { return m_drain; }
+	// The index of the node below the drain that the water spills down to, or -1 if it didn't spill
+	int getOutflow() const { return m_outflow; }
+	// The nodes around the pool it didn't take in, with their water heights. Only all of them if all the water settled.
+	const std::vector<std::pair<float, int>>& getShore() const { return m_queue; }
+	// The corners of the area pours are kept within, with the far corner just outside it
+	glm::ivec4 getArea() const { return m_area; }
+	// Whether the pool reached the edge of the map, where the rest of the water runs off
+	bool reachedEdge() const { return m_reachedEdge; }
+	// Whether the pool reached the edge of its area. The pool is left unfinished.
+	bool reachedBounds() const { return m_reachedBounds; }
+
+protected:
+	/***************************************************************************//**
+	 * Adds a node to the pool, and queues the nodes around it it hasn't reached yet.
+	 @param nodes The nodes to fill
+	 @param index The index of the node
+	 @return False if the node is on the edge of the map, or a node around it is outside the area
+	 ******************************************************************************/
+	bool take(const Node* nodes, int index);
+
+	const HaloGrid* m_grid = nullptr;
+	glm::ivec4 m_area = glm::ivec4(0);
+	// The pour each node of the area was last reached by, row by row
+	std::vector<unsigned int> m_visits;
+	unsigned int m_fill = 0;
+
+	// The nodes around the pool, by water height and then index, as a min-heap
+	std::vector<std::pair<float, int>> m_queue;
+	std::vector<int> m_set;
+	float m_volume = 0.0f;
+	int m_drain = -1;
+	int m_outflow = -1;
+	bool m_reachedEdge = false;
+	bool m_reachedBounds = false;
+};
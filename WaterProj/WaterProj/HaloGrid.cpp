@@ -0,0 +1,51 @@
+#include "HaloGrid.h"
+
+// Interleaves the bits of a coordinate within a tile with zeros, ready to be combined with the other coordinate
+static int spreadBits(int value)
+{
+	value = (value | (value << 8)) & 0x00FF00FF;
+	value = (value | (value << 4)) & 0x0F0F0F0F;
+	value = (value | (value << 2)) & 0x33333333;
+	return (value | (value << 1)) & 0x55555555;
+}
+
+void HaloGrid::build(int width, int height, bool tiled)
+{
+	m_dimensions = glm::ivec2(width, height);
+	m_tiled = tiled;
+	m_stride = width + HALO_WIDTH * 2;
+	m_indices.resize(m_stride * (height + HALO_WIDTH * 2));
+	m_haloIndices.resize(width * height);
+
+	for (int y = -HALO_WIDTH; y < height + HALO_WIDTH; ++y)
+	{
+		for (int x = -HALO_WIDTH; x < width + HALO_WIDTH; ++x)
+		{
+			const int index = storageIndex(glm::clamp(x, 0, width - 1), glm::clamp(y, 0, height - 1));
+			const bool inside = x >= 0 && x < width && y >= 0 && y < height;
+			m_indices[haloIndex(x, y)] = inside ? index : ~index;
+			if (inside)
+				m_haloIndices[index] = haloIndex(x, y);
+		}
+	}
+}
+
+int HaloGrid::storageIndex(int x, int y) const
+{
+	if (!m_tiled)
+		return y * m_dimensions.x + x;
+
+	// Every tile in a row of tiles is as tall as the row, and all but the last are full width
+	const int tileX = x / NODE_TILE_SIZE;
+	const int tileY = y / NODE_TILE_SIZE;
+	const int rowHeight = glm::min(NODE_TILE_SIZE, m_dimensions.y - tileY * NODE_TILE_SIZE);
+	const int tileWidth = glm::min(NODE_TILE_SIZE, m_dimensions.x - tileX * NODE_TILE_SIZE);
+	const int tileStart = tileY * NODE_TILE_SIZE * m_dimensions.x + tileX * NODE_TILE_SIZE * rowHeight;
+	const int localX = x - tileX * NODE_TILE_SIZE;
+	const int localY = y - tileY * NODE_TILE_SIZE;
+
+	if (tileWidth < NODE_TILE_SIZE || rowHeight < NODE_TILE_SIZE)
+		return tileStart + localY * tileWidth + localX;
+
+	return tileStart + (spreadBits(localX) | (spreadBits(localY) << 1));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <glm.hpp>
+#include <vector>
+
+// The width of the border around the grid. As wide as the largest level of detail step the renderer takes between tiles.
+#define HALO_WIDTH 8
+// The width and height of the tiles nodes are stored in with the tiled layout
+#define NODE_TILE_SIZE 32
+
+/***************************************************************************//**
+ * An index table over a grid of nodes, with a border (halo) of replicated
+ * entries all round it. Any node within HALO_WIDTH of the grid can be looked
+ * up without checking bounds, and the neighbours of a node are found by
+ * adding fixed offsets to its halo index.
+ *
+ * Entries inside the grid hold the index of their node. Border entries hold
+ * the bitwise negated index of the nearest node on the edge, so stencils that
+ * clamp to the edge decode every entry the same way, while those that need to
+ * skip the outside of the map can test the sign.
+ *
+ * The grid also decides the order nodes are stored in. Nodes are either stored
+ * row by row, or in NODE_TILE_SIZE square tiles with the nodes of each tile in
+ * Morton (Z) order, so that neighbours in both directions are mostly close in
+ * memory. Tiles cut short by the edge of the map are stored row by row. All
+ * conversion between positions and node indices goes through the grid.
+ ******************************************************************************/
+class HaloGrid
+{
+public:
+	/***************************************************************************//**
+	 * Builds the index table for a grid.
+	 @param width The width of the grid
+	 @param height The height of the grid
+	 @param tiled Whether nodes are stored in tiles, rather than row by row
+	 ******************************************************************************/
+	void build(int width, int height, bool tiled = false);
+	/***************************************************************************//**
+	 * The position of a node within the index table. Coordinates may be up to
+	 * HALO_WIDTH outside of the grid.
+	 @param x The X coordinate of the node
+	 @param y The Y coordinate of the node
+	 ******************************************************************************/
+	int haloIndex(int x, int y) const { return (y + HALO_WIDTH) * m_stride + x + HALO_WIDTH; }
+	int entry(int haloIndex) const { return m_indices[haloIndex]; }
+	/***************************************************************************//**
+	 * The index of the node an entry refers to, clamping border entries onto the edge.
+	 @param entry The entry from the index table
+	 ******************************************************************************/
+	static int clamped(int entry) { return entry ^ (entry >> 31); }
+	static bool isInside(int entry) { return entry >= 0; }
+	/***************************************************************************//**
+	 * The index of the node at a position, clamped onto the grid.
+	 @param x The X coordinate, up to HALO_WIDTH outside of the grid
+	 @param y The Y coordinate, up to HALO_WIDTH outside of the grid
+	 ******************************************************************************/
+	int at(int x, int y) const { return clamped(m_indices[haloIndex(x, y)]); }
+	/***************************************************************************//**
+	 * The index of the node at a position within the grid.
+	 @param x The X coordinate of the node
+	 @param y The Y coordinate of the node
+	 ******************************************************************************/
+	int index(int x, int y) const { return m_indices[haloIndex(x, y)]; }
+	int haloIndexOf(int index) const { return m_haloIndices[index]; }
+	glm::ivec2 position(int index) const { return glm::ivec2(m_haloIndices[index] % m_stride - HALO_WIDTH, m_haloIndices[index] / m_stride - HALO_WIDTH); }
+	// The distance between rows of the index table, for stepping to neighbours above and below
+	int getStride() const { return m_stride; }
+	glm::ivec2 getDimensions() const { return m_dimensions; }
+	// Whether a position lies on the grid. False for NaN positions, which drops can end up with.
+	bool contains(glm::vec2 pos) const { return pos.x >= 0.0f && pos.x < m_dimensions.x && pos.y >= 0.0f && pos.y < m_dimensions.y; }
+	bool isTiled() const { return m_tiled; }
+
+protected:
+	int storageIndex(int x, int y) const;
+
+	std::vector<int> m_indices;
+	// The halo index of every node, by node index
+	std::vector<int> m_haloIndices;
+	bool m_tiled = false;
+	int m_stride = 0;
+	glm::ivec2 m_dimensions = glm::ivec2(0);
+};
@@ -0,0 +1,223 @@
+#include "Lakes.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "HaloGrid.h"
+#include "Node.h"
+
+// The list the thread notes nodes whose lakes it couldn't reach in, while redirected
+static thread_local std::vector<int>* unresolvedNodes = nullptr;
+
+void Lakes::clear(const HaloGrid* grid)
+{
+	const glm::ivec2 dim = grid->getDimensions();
+	m_grid = grid;
+	m_parent.assign(dim.x * dim.y, -1);
+	m_generation.assign(dim.x * dim.y, 0);
+	m_stamp.assign(dim.x * dim.y, 0);
+	m_lakes.clear();
+	m_lakes.resize(dim.x * dim.y);
+}
+
+int Lakes::find(int index, glm::ivec4 area)
+{
+	const int lake = root(index, area);
+	if (lake < 0)
+		return -1;
+
+	const Lake& found = *m_lakes[lake];
+	if (found.bounds.x < area.x || found.bounds.y < area.y || found.bounds.z > area.z || found.bounds.w > area.w)
+		return -1;
+
+	return lake;
+}
+
+bool Lakes::canHold(int lake, float volume) const
+{
+	const Lake& found = *m_lakes[lake];
+	return (found.rim - found.plane) * found.cells.size() >= volume;
+}
+
+void Lakes::add(Node* nodes, int lake, float volume)
+{
+	Lake& found = *m_lakes[lake];
+	found.plane += volume / found.cells.size();
+	found.volume += volume;
+	for (int cell : found.cells)
+		nodes[cell].setWaterHeight(found.plane);
+}
+
+void Lakes::settle(const Node* nodes, const std::vector<int>& cells, const std::vector<std::pair<float, int>>& shore, float plane, glm::ivec4 area)
+{
+	// Count how many of the pool's nodes are in each lake it covers. Kept here, as pools on different tiles settle at the same time.
+	std::vector<std::pair<int, int>> covering;
+	bool reached = true;
+	for (int cell : cells)
+	{
+		const int lake = root(cell, area);
+		if (lake == LAKE_UNREACHED)
+		{
+			unresolved(cell);
+			reached = false;
+		}
+		if (lake < 0)
+			continue;
+
+		auto covered = std::find_if(covering.begin(), covering.end(), [&](const std::pair<int, int>& entry) { return entry.first == lake; });
+		if (covered == covering.end())
+			covering.push_back(std::make_pair(lake, 1));
+		else
+			covered->second++;
+	}
+
+	// The biggest lake the pool covers all of holds it, so its nodes needn't be joined again
+	int merged = -1;
+	size_t biggest = 0;
+	for (const std::pair<int, int>& covered : covering)
+	{
+		const size_t size = m_lakes[covered.first]->cells.size();
+		if ((size_t)covered.second == size && size > biggest)
+		{
+			merged = covered.first;
+			biggest = size;
+		}
+	}
+
+	// Lakes the pool only covers part of aren't level any more. Nor is anything, if some of its nodes' lakes couldn't be reached.
+	for (const std::pair<int, int>& covered : covering)
+	{
+		if (!reached || (size_t)covered.second != m_lakes[covered.first]->cells.size())
+			discard(covered.first);
+	}
+
+	if (!reached)
+		return;
+
+	if (merged < 0)
+	{
+		merged = cells.front();
+		join(merged, merged);
+		m_lakes[merged].reset(new Lake());
+	}
+
+	// The other lakes the pool covers all of are joined to it, with their nodes
+	for (const std::pair<int, int>& covered : covering)
+	{
+		if (covered.first != merged && m_lakes[covered.first])
+		{
+			m_parent[covered.first] = merged;
+			m_stamp[covered.first] = m_generation[merged];
+			m_lakes[covered.first].reset();
+		}
+	}
+
+	// Anything else the pool covers is joined straight to it
+	for (int cell : cells)
+	{
+		if (root(cell, area) != merged)
+			join(cell, merged);
+	}
+
+	Lake& lake = *m_lakes[merged];
+	const glm::ivec2 dim = m_grid->getDimensions();
+	lake.plane = plane;
+	lake.volume = 0.0f;
+	lake.rim = std::numeric_limits<float>::max();
+	lake.bounds = glm::ivec4(dim, 0, 0);
+	lake.cells = cells;
+	for (int cell : cells)
+		lake.volume += nodes[cell].waterDepth();
+
+	// The shore surrounds the lake, so covers all of it
+	for (const std::pair<float, int>& node : shore)
+	{
+		const glm::ivec2 pos = m_grid->position(node.second);
+		lake.rim = glm::min(lake.rim, node.first);
+		lake.bounds = glm::ivec4(glm::min(glm::ivec2(lake.bounds.x, lake.bounds.y), pos), glm::max(glm::ivec2(lake.bounds.z, lake.bounds.w), pos + 1));
+	}
+}
+
+void Lakes::forget(int index, glm::ivec4 area)
+{
+	const int lake = root(index, area);
+	if (lake >= 0)
+		discard(lake);
+	else if (lake == LAKE_UNREACHED)
+		unresolved(index);
+}
+
+void Lakes::forgetAround(int index, glm::ivec4 area)
+{
+	const glm::ivec2 dim = m_grid->getDimensions();
+	const glm::ivec2 pos = m_grid->position(index);
+	for (int y = glm::max(pos.y - 1, 0); y <= glm::min(pos.y + 1, dim.y - 1); ++y)
+	{
+		for (int x = glm::max(pos.x - 1, 0); x <= glm::min(pos.x + 1, dim.x - 1); ++x)
+			forget(m_grid->index(x, y), area);
+	}
+}
+
+void Lakes::redirect(std::vector<int>* unresolved)
+{
+	unresolvedNodes = unresolved;
+}
+
+int Lakes::root(int index, glm::ivec4 area)
+{
+	// Nodes outside the area may be being joined to other lakes at the same time, so aren't looked at
+	auto outside = [&](int node)
+	{
+		const glm::ivec2 pos = m_grid->position(node);
+		return pos.x < area.x || pos.y < area.y || pos.x >= area.z || pos.y >= area.w;
+	};
+
+	int found = index;
+	while (true)
+	{
+		if (outside(found))
+			return LAKE_UNREACHED;
+
+		const int next = m_parent[found];
+		if (next < 0)
+			return -1;
+		if (outside(next))
+			return LAKE_UNREACHED;
+
+		// The node joined to has been rejoined or forgotten since
+		if (m_stamp[found] != m_generation[next])
+			return -1;
+		if (next == found)
+			break;
+		found = next;
+	}
+
+	for (int node = index; node != found;)
+	{
+		const int next = m_parent[node];
+		m_parent[node] = found;
+		m_stamp[node] = m_generation[found];
+		node = next;
+	}
+
+	return found;
+}
+
+void Lakes::join(int index, int parent)
+{
+	m_generation[index]++;
+	m_parent[index] = parent;
+	m_stamp[index] = m_generation[parent];
+}
+
+void Lakes::discard(int lake)
+{
+	m_lakes[lake].reset();
+	m_generation[lake]++;
+}
+
+void Lakes::unresolved(int index)
+{
+	if (unresolvedNodes)
+		unresolvedNodes->push_back(index);
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <glm.hpp>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class HaloGrid;
+class Node;
+
+// What root gives for a node whose way to its lake leaves the area it was asked for
+#define LAKE_UNREACHED -2
+
+/***************************************************************************//**
+ * A pool that water settled in, kept so that drops reaching it can be added to
+ * it without finding it again.
+ ******************************************************************************/
+struct Lake
+{
+	// The height of the lake's surface
+	float plane = 0.0f;
+	// The water held in the lake
+	float volume = 0.0f;
+	// The lowest water height around the lake, when it settled
+	float rim = 0.0f;
+	// The corners of the area covering the lake and the nodes around it, with the far corner just outside it
+	glm::ivec4 bounds = glm::ivec4(0);
+	// The indices of the nodes covered by the lake
+	std::vector<int> cells;
+};
+
+/***************************************************************************//**
+ * The lakes left by drops settling in pools, kept from one erosion pass to the
+ * next. Nodes are joined to lakes as a union-find forest, rooted at a node of
+ * each lake that holds it, so lakes that fill into each other merge by joining
+ * their roots rather than every node they cover.
+ *
+ * Lakes are kept as they were left, and have to be told about anything else
+ * changing the water around them. A lake is forgotten as soon as one of its
+ * nodes, or one of the nodes around it, changes height, which leaves every
+ * node joined to it unjoined at once: each join is stamped with how many
+ * times the node it joins to had been rejoined or forgotten, and only holds
+ * while that count is the same.
+ *
+ * Lakes are only read or changed within an area, so they can be used while
+ * the rest of the map changes. Lakes a thread can't reach within its area are
+ * noted down to be forgotten once no other threads are running.
+ ******************************************************************************/
+class Lakes
+{
+public:
+	/***************************************************************************//**
+	 * Forgets every lake, and makes room for those on a grid.
+	 @param grid The grid over the nodes lakes form on
+	 ******************************************************************************/
+	void clear(const HaloGrid* grid);
+	/***************************************************************************//**
+	 * Finds the lake covering a node.
+	 @param index The index of the node
+	 @param area The corners of the area the lake has to be within, with the far corner just outside it
+	 @return The lake's root, or -1 if the node isn't covered by a lake within the area
+	 ******************************************************************************/
+	int find(int index, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Whether a lake can take in water without rising to the nodes around it.
+	 @param lake The root of the lake, as found
+	 @param volume The water to add
+	 ******************************************************************************/
+	bool canHold(int lake, float volume) const;
+	/***************************************************************************//**
+	 * Adds water to a lake, raising its surface evenly over every node it covers.
+	 @param nodes The nodes of the map
+	 @param lake The root of the lake, as found
+	 @param volume The water to add, which the lake must be able to hold
+	 ******************************************************************************/
+	void add(Node* nodes, int lake, float volume);
+	/***************************************************************************//**
+	 * Keeps a pool water has just settled in as a lake. Lakes it covers all of
+	 * are merged into it, and those it only covers part of are forgotten. The
+	 * pool isn't kept if any of its nodes are joined to lakes that can't be
+	 * reached within the area.
+	 @param nodes The nodes of the map, with the pool's water heights already set
+	 @param cells The indices of the nodes in the pool
+	 @param shore The nodes around the pool it didn't take in, with their water heights
+	 @param plane The height of the pool's surface
+	 @param area The corners of the area the pool was found within, with the far corner just outside it
+	 ******************************************************************************/
+	void settle(const Node* nodes, const std::vector<int>& cells, const std::vector<std::pair<float, int>>& shore, float plane, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Forgets the lake covering a node whose water height has changed.
+	 @param index The index of the node
+	 @param area The corners of the area to find the lake within, with the far corner just outside it
+	 ******************************************************************************/
+	void forget(int index, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Forgets the lakes covering a node or next to it, for a node whose water
+	 * height may have fallen, as it may have been part of a lake's shore.
+	 @param index The index of the node
+	 @param area The corners of the area to find the lakes within, with the far corner just outside it
+	 ******************************************************************************/
+	void forgetAround(int index, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Has the calling thread note the nodes whose lakes it couldn't reach to
+	 * forget, to be forgotten later over the whole map.
+	 @param unresolved The list to note nodes in, or nullptr to stop
+	 ******************************************************************************/
+	static void redirect(std::vector<int>* unresolved);
+	// The indices of the nodes covered by a lake
+	const std::vector<int>& getCells(int lake) const { return m_lakes[lake]->cells; }
+	// The height of a lake's surface
+	float getPlane(int lake) const { return m_lakes[lake]->plane; }
+	// The water held in a lake
+	float getVolume(int lake) const { return m_lakes[lake]->volume; }
+
+protected:
+	/***************************************************************************//**
+	 * Finds the root of the lake a node was joined to, shortening the way there
+	 * for the nodes passed on the way.
+	 @param index The index of the node
+	 @param area The corners of the area to follow the way within, with the far corner just outside it
+	 @return The root, -1 if the node isn't joined to a lake, or LAKE_UNREACHED if the way leaves the area
+	 ******************************************************************************/
+	int root(int index, glm::ivec4 area);
+	/***************************************************************************//**
+	 * Joins a node to another, leaving anything joined to the node unjoined.
+	 @param index The index of the node
+	 @param parent The index of the node to join it to
+	 ******************************************************************************/
+	void join(int index, int parent);
+	/***************************************************************************//**
+	 * Forgets a lake, leaving every node joined to it unjoined.
+	 @param lake The root of the lake
+	 ******************************************************************************/
+	void discard(int lake);
+	/***************************************************************************//**
+	 * Notes a node whose lake couldn't be reached, if the thread is noting them.
+	 @param index The index of the node
+	 ******************************************************************************/
+	static void unresolved(int index);
+
+	const HaloGrid* m_grid = nullptr;
+	// The node each node was joined to, itself for roots, or -1 for nodes never covered by a lake
+	std::vector<int> m_parent;
+	// How many times each node had been rejoined or forgotten, which joins to it are stamped with
+	std::vector<int> m_generation;
+	// The generation of the node each node was joined to, when it was joined
+	std::vector<int> m_stamp;
+	// The lake held by each root, or nothing for every other node
+	std::vector<std::unique_ptr<Lake>> m_lakes;
+};
@@ -1,14 +1,21 @@
 #include "Map.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <glm.hpp>
 #include <ext.hpp>
 #include <sstream>
+#include <unordered_set>
 
+#include "BinaryStream.h"
 #include "Drop.h"
 #include "MapRenderer.h"
+#include "NoiseCache.h"
 #include "Node.h"
 #include "PerlinNoise.h"
 #include "Plant.h"
+#include "Subsurface.h"
+#include "ThreadPool.h"
 
 ///////////////////////////////////////////////////////////////////////////////// MapParams
 
@@ -92,77 +99,275 @@ void MapParams::loadFromFile()
 
 ///////////////////////////////////////////////////////////////////////////////// Map
 
+// Parameters that only the simulation reads. Anything not listed here or under a generation stage is taken to change
+// the whole world generated, so a new parameter can at worst cause worlds to be generated again needlessly.
+static const std::unordered_set<std::string> simulationParams = {
+	"workerThreads", "erosionTileSize", "validateNoiseCache", "worldCache", "treeSpreadChance", "treeSpreadRadius", "treeLongDistanceFertilizationCount",
+	"treeRandomDeathChance", "streamEvaporationRate", "particleEvaporationRate", "dropWidth", "dropDefaultVolume", "dropMinimumVolume",
+	"dropSedimentSimulationMinimumVelocity", "dropSedimentSimulationTerminationVelocity", "dropSedimentDepositCap", "dropContainedSedimentCap",
+	"particleTerminationProximity", "particleSwayMagnitude", "poolSedimentLossRate", "markerCoalesceTolerance",
+	"cliffThreshold"
+};
+
+// The parameters each generation stage reads, indexed by generationStage
+static const std::vector<std::string> generationStageParams[GenerationStage_Count] = {
+	{ "noiseSampleHeight", "scale", "noiseCacheDensity", "baseVariance", "lieChangeRate", "liePeak", "lieModif", "hillHeight", "hillRarity",
+		"hillVariancePower", "divetRarity", "divetHillScalar", "mountainHeight", "mountainRarity", "mountainThreshold", "mountainConstantMultiplier" },
+	{ "noiseSampleHeight", "scale", "sandHeightVariance", "minimumSandHeight", "sandResistivity", "sandFertility", "soilResistivityChangeRate",
+		"soilResistivityBase", "soilResistivityVariance", "soilSandContent", "soilSandVariance", "soilClayContent", "soilFertility" },
+	{ "scale", "tiledNodeLayout", "seaLevel", "bedrockResisitivity", "generatedMapDensity", "lazySubsurfaceDepth", "generatedMarkerTolerance",
+		"rockRarity", "rockVerticalScaling", "rockThreshold", "rockResistivityBase", "rockResistivityVariance", "soilResistivityChangeRate",
+		"soilResistivityBase", "soilResistivityVariance", "soilSandContent", "soilSandVariance", "soilClayContent", "soilClayVariance", "soilFertility" },
+	{ "treeGenerationRarity", "foliageOverpopulationThreshold", "treeParticleDeathThreshold", "treeSlopeThreshold" },
+	{ "springThreshold", "minimumSpringHeight", "springRarity" },
+};
+static const char* generationStageNames[GenerationStage_Count] = { "heightfield", "surface", "rocks and dirt", "trees", "springs" };
+
+/***************************************************************************//**
+ * Finds the first generation stage to read a parameter.
+ @param param The name of the parameter
+ @return The generationStage, or GenerationStage_Count if only the simulation reads it
+ ******************************************************************************/
+static int getFirstStageReading(const std::string& param)
+{
+	if (simulationParams.count(param))
+		return GenerationStage_Count;
+
+	for (int stage = 0; stage < GenerationStage_Count; ++stage)
+	{
+		if (std::find(generationStageParams[stage].begin(), generationStageParams[stage].end(), param) != generationStageParams[stage].end())
+			return stage;
+	}
+
+	// Not listed anywhere, so it could change anything
+	return GenerationStage_Heightfield;
+}
+
+/***************************************************************************//**
+ * Ensure our values are valid- rarity must be a multiple of scale in these
+ * parameters or we hit rounding errors.
+ @param params The parameters to correct
+ ******************************************************************************/
+static void fitRaritiesToScale(MapParams& params)
+{
+	params.hillRarity -= (params.hillRarity % params.scale);
+	params.mountainRarity -= (params.mountainRarity % params.scale);
+	params.divetRarity -= (params.divetRarity % params.scale);
+}
+
+static std::string getWorldPath(unsigned long long key)
+{
+	std::stringstream path;
+	path << "world_" << std::hex << key << ".bin";
+	return path.str();
+}
+
 Map::Map(int width, int height, MapParams params, unsigned int seed)
 {
 	defineSoils();
-	m_nodes = new Node[width * height];
+	m_nodes = nullptr;
 	m_width = width;
 	m_height = height;
+	m_age = 0;
+	m_growth = 0;
 	m_maxHeight = 0.0f;
 	m_params = params;
+	fitRaritiesToScale(m_params);
+	m_grid.build(width, height, m_params.tiledNodeLayout != 0);
 
 	// Seed based on time or whatever was given
 	if(seed == 0)
-		srand(time(NULL));
-	else
-		srand(seed);
+		seed = time(NULL);
+	m_random = Random(seed);
 
-	// A selection of varying perlin noise is needed to generate complex terrain
-	PerlinNoise noises[8];
-	for (int i = 0; i < 8; i++)
+	// A world generated before from the same seed and parameters is read back rather than generated again
+	const unsigned long long worldKey = getWorldKey(m_params, width, height, seed);
+	if (m_params.worldCache && loadWorld(getWorldPath(worldKey), worldKey))
 	{
-		int generatedSeed = rand() % 99999;
-		noises[i] = PerlinNoise(generatedSeed);
+		PerlinNoise noises[8];
+		createNoises(noises);
+		m_subsurface = std::make_shared<Subsurface>(noises[NoiseType_Resistivity], noises[NoiseType_Rock], m_params, m_maxHeight);
+		for (int i = 0; i < width * height; ++i)
+		{
+			m_nodes[i].relink(&m_columns);
+		}
+		m_columns.setSubsurface(m_subsurface.get(), m_nodes, &m_grid);
+		std::cout << "Loaded world from " << getWorldPath(worldKey) << std::endl;
+		return;
 	}
 
-	// Ensure our values are valid-  rarity must be a multiple of scale in these parameters or we hit rounding errors.
-	m_params.hillRarity -= (m_params.hillRarity % m_params.scale);
-	m_params.mountainRarity -= (m_params.mountainRarity % m_params.scale);
-	m_params.divetRarity -= (m_params.divetRarity % m_params.scale);
+	generate(GenerationStage_Heightfield);
+	if (m_params.worldCache)
+		saveWorld(getWorldPath(worldKey), worldKey);
+}
 
-	float completion = 0.0f;
+Map::Map(int width, int height, MapParams params, unsigned int seed, int previewSpacing)
+{
+	defineSoils();
+	m_nodes = nullptr;
+	m_age = 0;
+	m_growth = 0;
+	m_maxHeight = 0.0f;
+	m_params = params;
+	fitRaritiesToScale(m_params);
+	// The lattice caches are laid out over every node, so the noise is sampled directly
+	m_params.noiseCacheDensity = 0;
 
+	if(seed == 0)
+		seed = time(NULL);
+	m_random = Random(seed);
+
+	// Sample the surface on a coarse grid reaching just past the far edges of the map
+	PerlinNoise noises[8];
+	createNoises(noises);
+	m_threads.reset(new ThreadPool(m_params.workerThreads));
+	m_sampleSpacing = previewSpacing;
+	m_width = (width - 1) / previewSpacing + 2;
+	m_height = (height - 1) / previewSpacing + 2;
+	generateHeightfield(noises);
+	generateSurface(noises);
+	std::vector<NodeMarker> samples;
+	samples.swap(m_surfaceMarkers);
+	const int sampleHeight = m_height;
+
+	// Every node between the samples takes its height and color from the four around it
+	m_sampleSpacing = 1;
+	m_width = width;
+	m_height = height;
+	m_surfaceMarkers.resize(width * height);
 	for (int x = 0; x < width; ++x)
 	{
+		const int sampleX = x / previewSpacing;
+		const float weightX = (x % previewSpacing) / (float)previewSpacing;
 		for (int y = 0; y < height; ++y)
 		{
-			float val = noises[NoiseType_BaseVariance].noise(x, y, m_params.noiseSampleHeight) * m_params.baseVariance;
-			const float base = (noises[NoiseType_Lie].noise(x/(m_params.lieChangeRate / m_params.scale), y/(m_params.lieChangeRate / m_params.scale), m_params.noiseSampleHeight) * m_params.liePeak / m_params.scale) + (m_params.lieModif / m_params.scale);
-			const float hill = getHillValue(&noises[NoiseType_Hill], x, y, m_params.hillHeight, m_params.hillRarity);
-			const float div = getDivetValue(&noises[NoiseType_Divet], x, y, m_params.hillHeight * m_params.divetHillScalar, m_params.divetRarity);
-			const float mount = getMountainValue(&noises[NoiseType_Mountain], x, y, m_params.mountainHeight, m_params.mountainRarity);
-			float total = (base + val + hill + mount + div);
+			const int sampleY = y / previewSpacing;
+			const float weightY = (y % previewSpacing) / (float)previewSpacing;
+			NodeMarker low = samples[sampleX * sampleHeight + sampleY];
+			low.mix(samples[(sampleX + 1) * sampleHeight + sampleY], weightX);
+			NodeMarker high = samples[sampleX * sampleHeight + sampleY + 1];
+			high.mix(samples[(sampleX + 1) * sampleHeight + sampleY + 1], weightX);
+			low.mix(high, weightY);
+			m_surfaceMarkers[x * height + y] = low;
+		}
+	}
+	placeSurfaces();
 
-#ifdef FLOODTESTMAP
-			// custom map
-			total = (abs(x-500) + abs(y-500))/20.0f;
-#endif
+	// Nothing of the preview can be reused for the real map
+	m_surfaceHeights.clear();
+	m_surfaceMarkers.clear();
+	m_changedSinceGeneration = true;
+}
 
-			const float sandThreshold = noises[NoiseType_Sand].noise(x, y, m_params.noiseSampleHeight) * m_params.sandHeightVariance + m_params.minimumSandHeight;
+void Map::regenerate(MapParams params)
+{
+	fitRaritiesToScale(params);
 
-			if (total < sandThreshold)
-			{
-				// Sand (1.5g/cm3)
-				m_nodes[y * width + x].addMarker(glm::max(BEDROCK_SAFETY_LAYER, total), m_params.sandResistivity, false, glm::vec3(1.0f, 1.0f, 0.7f), m_params.sandFertility, 1.0f, 0.0f, m_maxHeight);
-			}
-			else
-			{
-				// Topsoil (2.3g/cm3). Clay will make more resistive, sand will make less resistive.
-				float topNoise = noises[NoiseType_Resistivity].noise(x / (m_params.soilResistivityChangeRate / m_params.scale), y / (m_params.soilResistivityChangeRate / m_params.scale), glm::max(BEDROCK_SAFETY_LAYER, total));
-				float sandAmount = m_params.soilSandContent + (1.0f - topNoise) * m_params.soilSandVariance;
-				float clayAmount = m_params.soilClayContent + topNoise * m_params.soilSandContent;
-				float resistivity = m_params.soilResistivityBase + topNoise * m_params.soilResistivityVariance;
-				m_nodes[y * width + x].addMarker(glm::max(BEDROCK_SAFETY_LAYER, total), resistivity, false, glm::vec3(0.2f + topNoise * 0.4f, 0.3f, 0.0f), m_params.soilFertility, sandAmount, clayAmount, m_maxHeight);
-			}
-			// Bedrock (7.5g/cm3)
-			m_nodes[y * width + x].addMarker(BEDROCK_LAYER, m_params.bedrockResisitivity, true, glm::vec3(0.1f), 0.0f, 0.0f, 0.0f, m_maxHeight);
-			// Fill all nodes to a basic "sea level"
-			m_nodes[y * width + x].setWaterHeight(m_params.seaLevel);
-		}
+	int firstStage = GenerationStage_Count;
+	for (const auto& param : params.floatPropertyMap)
+	{
+		if (m_params.floatPropertyMap.at(param.first) != param.second)
+			firstStage = glm::min(firstStage, getFirstStageReading(param.first));
+	}
+	for (const auto& param : params.intPropertyMap)
+	{
+		if (m_params.intPropertyMap.at(param.first) != param.second)
+			firstStage = glm::min(firstStage, getFirstStageReading(param.first));
+	}
+
+	// Nodes that have been simulated no longer hold what generation left in them, and maps that were loaded or forked
+	// never kept what the first stages produced
+	if (m_changedSinceGeneration)
+		firstStage = glm::min(firstStage, (int)GenerationStage_RocksAndDirt);
+	if (m_surfaceHeights.empty() || m_surfaceMarkers.empty())
+		firstStage = GenerationStage_Heightfield;
+
+	// Parameters only the simulation reads take effect either way
+	m_params = params;
+	if (firstStage == GenerationStage_Count)
+	{
+		std::cout << "No generation parameters changed, keeping the map as it is" << std::endl;
+		return;
+	}
+
+	std::cout << "Regenerating from the " << generationStageNames[firstStage] << " stage" << std::endl;
+	m_age = 0;
+	m_growth = 0;
+	generate(firstStage);
+
+	const unsigned long long worldKey = getWorldKey(m_params, m_width, m_height, m_random.getSeed());
+	if (m_params.worldCache)
+		saveWorld(getWorldPath(worldKey), worldKey);
+}
+
+void Map::generate(int firstStage)
+{
+	PerlinNoise noises[8];
+	createNoises(noises);
+	m_threads.reset(new ThreadPool(m_params.workerThreads));
+
+	if (firstStage <= GenerationStage_Heightfield)
+		generateHeightfield(noises);
+	if (firstStage <= GenerationStage_Surface)
+		generateSurface(noises);
+	if (firstStage <= GenerationStage_RocksAndDirt)
+		addRocksAndDirt(noises);
+	if (firstStage <= GenerationStage_Trees)
+		placeTrees();
+	if (firstStage <= GenerationStage_Springs)
+		placeSprings();
+
+	m_changedSinceGeneration = false;
+}
+
+void Map::createNoises(PerlinNoise* noises)
+{
+	// A selection of varying perlin noise is needed to generate complex terrain
+	for (int i = 0; i < 8; i++)
+	{
+		int generatedSeed = m_random.range(RandomStage_NoiseSeed, glm::ivec2(i, 0), 0, 99999);
+		noises[i] = PerlinNoise(generatedSeed);
+	}
+}
+
+void Map::generateHeightfield(PerlinNoise* noises)
+{
+	// Low frequency noise is sampled on a lattice and interpolated, wherever its features are wide enough for it
+	NoiseCache caches[CachedNoise_Count];
+	if (m_params.noiseCacheDensity > 0)
+	{
+		auto buildCache = [&](int cache, PerlinNoise* noise, float period, float z)
+		{
+			const int spacing = (int)(period / m_params.noiseCacheDensity);
+			if (spacing >= 2)
+				caches[cache].build(noise, m_width, m_height, period, z, spacing);
+		};
+		buildCache(CachedNoise_Lie, &noises[NoiseType_Lie], m_params.lieChangeRate / m_params.scale, m_params.noiseSampleHeight);
+		buildCache(CachedNoise_Hill, &noises[NoiseType_Hill], m_params.hillRarity / (float)m_params.scale, m_params.noiseSampleHeight);
+		buildCache(CachedNoise_HillVariance, &noises[NoiseType_Hill], m_params.hillRarity / (float)m_params.scale, m_params.noiseSampleHeight * 2.0f);
+		buildCache(CachedNoise_Divet, &noises[NoiseType_Divet], m_params.divetRarity / (float)m_params.scale, m_params.noiseSampleHeight);
+		buildCache(CachedNoise_Mountain, &noises[NoiseType_Mountain], m_params.mountainRarity / (float)m_params.scale, m_params.noiseSampleHeight);
+	}
+
+	// Noise is sampled for a band of rows at a time across the pool, showing progress between bands
+	m_surfaceHeights.resize(m_width * m_height);
+	std::vector<float> cacheErrors(GENERATION_BAND, 0.0f);
+	float maxCacheError = 0.0f;
+	float completion = 0.0f;
+
+	for (int band = 0; band < m_width; band += GENERATION_BAND)
+	{
+		const int bandWidth = glm::min(GENERATION_BAND, m_width - band);
+		m_threads->run(bandWidth, [&](int row)
+		{
+			cacheErrors[row] = generateHeights(noises, caches, band + row, &m_surfaceHeights[(band + row) * m_height]);
+		});
+		for (int row = 0; row < bandWidth; ++row)
+			maxCacheError = glm::max(maxCacheError, cacheErrors[row]);
 
 		// Display progress
 		float prevCompletion = completion;
-		completion = (x / (float)width) * 100.0f;
+		completion = (band / (float)m_width) * 100.0f;
 		if((int)completion % 10 < (int) prevCompletion % 10)
 		{
 			if (prevCompletion < 10.0f)
@@ -173,86 +378,387 @@ Map::Map(int width, int height, MapParams params, unsigned int seed)
 	}
 	std::cout << std::string(3, '\b') << "100 %";
 	std::cout << std::endl;
+	if (m_params.validateNoiseCache)
+		std::cout << "Noise cache: largest surface height error " << maxCacheError << std::endl;
+}
 
-	addRocksAndDirt(&noises[NoiseType_Resistivity], &noises[NoiseType_Rock]);
+void Map::generateSurface(PerlinNoise* noises)
+{
+	m_surfaceMarkers.resize(m_width * m_height);
+	m_threads->run(m_width, [&](int x)
+	{
+		generateSurfaces(noises, x, &m_surfaceHeights[x * m_height], &m_surfaceMarkers[x * m_height]);
+	});
 }
 
-void Map::addRocksAndDirt(PerlinNoise* resistivityNoise, PerlinNoise* rockNoise)
+unsigned long long Map::getWorldKey(const MapParams& params, int width, int height, unsigned int seed)
 {
-	// F=pV so resistivity and resistivity are linearly related
-	float completion = 0.0f;
-	float incrementValue = 1.0f / (float)m_params.generatedMapDensity;
+	// FNV-1a
+	unsigned long long key = 14695981039346656037ull;
+	auto hash = [&](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+			key = (key ^ bytes[i]) * 1099511628211ull;
+	};
+
+	// The layout of nodes and markers in memory is part of the file, so the build has to match too
+	const int version = WORLD_CACHE_VERSION;
+	const int nodeSize = sizeof(Node);
+#ifdef COMPACT_MARKERS
+	const int compact = 1;
+#else
+	const int compact = 0;
+#endif
+	hash(&version, sizeof(version));
+	hash(&nodeSize, sizeof(nodeSize));
+	hash(&compact, sizeof(compact));
+	hash(&width, sizeof(width));
+	hash(&height, sizeof(height));
+	hash(&seed, sizeof(seed));
+
+	for (const auto& param : params.floatPropertyMap)
+	{
+		if (simulationParams.count(param.first))
+			continue;
+		hash(param.first.c_str(), param.first.size() + 1);
+		hash(&param.second, sizeof(float));
+	}
+	for (const auto& param : params.intPropertyMap)
+	{
+		if (simulationParams.count(param.first))
+			continue;
+		hash(param.first.c_str(), param.first.size() + 1);
+		hash(&param.second, sizeof(int));
+	}
+
+	return key;
+}
+
+void Map::saveWorld(const std::string& path, unsigned long long key) const
+{
+	// Written to one side first, so a world cut short never takes the place of a whole one
+	const std::string partPath = path + ".part";
+	std::ofstream file(partPath, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to save world to " << path << std::endl;
+		return;
+	}
+
+	const int nodeCount = m_width * m_height;
+	writeValue(file, key);
+	writeValue(file, m_width);
+	writeValue(file, m_height);
+	writeValue(file, m_maxHeight);
+	writeVector(file, m_springs);
+	file.write(reinterpret_cast<const char*>(m_nodes), sizeof(Node) * nodeCount);
+	m_columns.save(file);
+	file.close();
+
+	// Replacing a damaged world, which rename won't do on its own on every platform
+	std::remove(path.c_str());
+	if (file.fail() || std::rename(partPath.c_str(), path.c_str()) != 0)
+	{
+		std::remove(partPath.c_str());
+		std::cout << "Failed to save world to " << path << std::endl;
+	}
+}
+
+bool Map::loadWorld(const std::string& path, unsigned long long key)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	unsigned long long fileKey;
+	int width, height;
+	float maxHeight;
+	if (!readValue(file, fileKey) || !readValue(file, width) || !readValue(file, height) || !readValue(file, maxHeight))
+		return false;
+	if (fileKey != key || width != m_width || height != m_height)
+		return false;
+
+	// Everything is read to one side first, so a damaged file leaves the map as it was to be generated instead
+	const int nodeCount = m_width * m_height;
+	std::vector<glm::vec2> springs;
+	Node* nodes = new Node[nodeCount];
+	ColumnStore columns;
+	bool read = readVector(file, springs);
+	read = read && file.read(reinterpret_cast<char*>(nodes), sizeof(Node) * nodeCount) && columns.load(file);
+	if (!read)
+	{
+		delete[] nodes;
+		std::cout << "Failed to read world from " << path << ", generating it again" << std::endl;
+		return false;
+	}
+
+	delete[] m_nodes;
+	m_nodes = nodes;
+	m_columns = std::move(columns);
+	m_springs = std::move(springs);
+	m_maxHeight = maxHeight;
+	m_lakes.clear(&m_grid);
+	return true;
+}
+
+void NoiseBatch::sample(PerlinNoise* noise, std::vector<double>& values) const
+{
+	values.resize(x.size());
+	noise->noise(x.data(), y.data(), z.data(), values.data(), (int)x.size());
+}
+
+float Map::generateHeights(PerlinNoise* noises, const NoiseCache* caches, int row, float* heights)
+{
+	// Previews only sample every m_sampleSpacing'th node, so their rows and columns are spread out over the map
+	const int x = row * m_sampleSpacing;
+
+	// Each kind of noise is sampled for the whole row at once
+	NoiseBatch batch;
+	std::vector<double> variance;
+	batch.resize(m_height);
+
+	for (int y = 0; y < m_height; ++y)
+		batch.set(y, x, y * m_sampleSpacing, m_params.noiseSampleHeight);
+	batch.sample(&noises[NoiseType_BaseVariance], variance);
+
+	// Low frequency noise comes from the caches that were built, and is sampled directly otherwise or to validate them
+	std::vector<double> cached[CachedNoise_Count];
+	std::vector<double> sampled[CachedNoise_Count];
+	bool direct[CachedNoise_Count];
+	for (int i = 0; i < CachedNoise_Count; ++i)
+	{
+		direct[i] = !caches[i].isBuilt() || m_params.validateNoiseCache;
+		if (caches[i].isBuilt())
+			caches[i].sampleRow(x, cached[i]);
+	}
+
+	auto sampleFromRarity = [&](PerlinNoise* noise, float rarity, float z, std::vector<double>& values)
+	{
+		for (int y = 0; y < m_height; ++y)
+		{
+			glm::vec2 XY = calculateXYFromRarity(x, y * m_sampleSpacing, rarity);
+			batch.set(y, XY.x, XY.y, z);
+		}
+		batch.sample(noise, values);
+	};
+	if (direct[CachedNoise_Lie])
+	{
+		for (int y = 0; y < m_height; ++y)
+			batch.set(y, x/(m_params.lieChangeRate / m_params.scale), (y * m_sampleSpacing)/(m_params.lieChangeRate / m_params.scale), m_params.noiseSampleHeight);
+		batch.sample(&noises[NoiseType_Lie], sampled[CachedNoise_Lie]);
+	}
+	if (direct[CachedNoise_Hill])
+		sampleFromRarity(&noises[NoiseType_Hill], m_params.hillRarity, m_params.noiseSampleHeight, sampled[CachedNoise_Hill]);
+	if (direct[CachedNoise_HillVariance])
+		sampleFromRarity(&noises[NoiseType_Hill], m_params.hillRarity, m_params.noiseSampleHeight * 2.0f, sampled[CachedNoise_HillVariance]);
+	if (direct[CachedNoise_Divet])
+		sampleFromRarity(&noises[NoiseType_Divet], m_params.divetRarity, m_params.noiseSampleHeight, sampled[CachedNoise_Divet]);
+	if (direct[CachedNoise_Mountain])
+		sampleFromRarity(&noises[NoiseType_Mountain], m_params.mountainRarity, m_params.noiseSampleHeight, sampled[CachedNoise_Mountain]);
+
+	for (int i = 0; i < CachedNoise_Count; ++i)
+	{
+		if (!caches[i].isBuilt())
+			cached[i] = sampled[i];
+	}
+
+	auto surfaceHeight = [&](const std::vector<double>* lowFrequency, int y)
+	{
+		float val = variance[y] * m_params.baseVariance;
+		const float base = (lowFrequency[CachedNoise_Lie][y] * m_params.liePeak / m_params.scale) + (m_params.lieModif / m_params.scale);
+		const float hillValue = getHillValue(lowFrequency[CachedNoise_Hill][y], lowFrequency[CachedNoise_HillVariance][y], m_params.hillHeight);
+		const float div = getDivetValue(lowFrequency[CachedNoise_Divet][y], m_params.hillHeight * m_params.divetHillScalar);
+		const float mount = getMountainValue(lowFrequency[CachedNoise_Mountain][y], m_params.mountainHeight);
+		float total = (base + val + hillValue + mount + div);
+
+#ifdef FLOODTESTMAP
+		// custom map
+		total = (abs(x-500) + abs(y * m_sampleSpacing - 500))/20.0f;
+#endif
+
+		return total;
+	};
+
+	float maxError = 0.0f;
+	for (int y = 0; y < m_height; ++y)
+	{
+		heights[y] = surfaceHeight(cached, y);
+		if (m_params.validateNoiseCache)
+			maxError = glm::max(maxError, glm::abs(heights[y] - surfaceHeight(sampled, y)));
+	}
+
+	return maxError;
+}
+
+void Map::generateSurfaces(PerlinNoise* noises, int row, const float* heights, NodeMarker* surfaces)
+{
+	const int x = row * m_sampleSpacing;
+	NoiseBatch batch;
+	std::vector<double> sand, resistivity;
+	batch.resize(m_height);
+
+	for (int y = 0; y < m_height; ++y)
+		batch.set(y, x, y * m_sampleSpacing, m_params.noiseSampleHeight);
+	batch.sample(&noises[NoiseType_Sand], sand);
+
+	// Topsoil noise is sampled at the height of the surface, so it can only be sampled once that's known.
+	// It's sampled for sand too, to keep the batch whole, and thrown away.
+	for (int y = 0; y < m_height; ++y)
+		batch.set(y, x / (m_params.soilResistivityChangeRate / m_params.scale), (y * m_sampleSpacing) / (m_params.soilResistivityChangeRate / m_params.scale), glm::max(BEDROCK_SAFETY_LAYER, heights[y]));
+	batch.sample(&noises[NoiseType_Resistivity], resistivity);
+
+	for (int y = 0; y < m_height; ++y)
+	{
+		const float total = heights[y];
+		const float sandThreshold = sand[y] * m_params.sandHeightVariance + m_params.minimumSandHeight;
+
+		if (total < sandThreshold)
+		{
+			// Sand (1.5g/cm3)
+			surfaces[y] = NodeMarker(glm::max(BEDROCK_SAFETY_LAYER, total), m_params.sandResistivity, false, glm::vec3(1.0f, 1.0f, 0.7f), m_params.sandFertility, 1.0f, 0.0f);
+			continue;
+		}
+
+		// Topsoil (2.3g/cm3). Clay will make more resistive, sand will make less resistive.
+		float topNoise = resistivity[y];
+		float sandAmount = m_params.soilSandContent + (1.0f - topNoise) * m_params.soilSandVariance;
+		float clayAmount = m_params.soilClayContent + topNoise * m_params.soilSandContent;
+		float resistivityValue = m_params.soilResistivityBase + topNoise * m_params.soilResistivityVariance;
+		surfaces[y] = NodeMarker(glm::max(BEDROCK_SAFETY_LAYER, total), resistivityValue, false, glm::vec3(0.2f + topNoise * 0.4f, 0.3f, 0.0f), m_params.soilFertility, sandAmount, clayAmount);
+	}
+}
+
+void Map::placeSurfaces()
+{
+	// Every column is built again from scratch, leaving any snapshots with the columns they had
+	const int count = m_width * m_height;
+	m_grid.build(m_width, m_height, m_params.tiledNodeLayout != 0);
+	delete[] m_nodes;
+	m_nodes = new Node[count]();
+	m_columns = ColumnStore();
+	m_sharedColumns.clear();
+	m_maxHeight = 0.0f;
+
+	// Room for the surface and bedrock markers. Columns are grown to their full depth in addRocksAndDirt.
+	m_columns.attach(m_nodes, count, 2);
+	m_lakes.clear(&m_grid);
 
 	for (int x = 0; x < m_width; ++x)
 	{
 		for (int y = 0; y < m_height; ++y)
 		{
-			bool isRock = false;
-			float height = getHeightAt(x, y);
+			// Bedrock (7.5g/cm3)
+			const NodeMarker column[2] = { NodeMarker(BEDROCK_LAYER, m_params.bedrockResisitivity, true, glm::vec3(0.1f), 0.0f, 0.0f, 0.0f), m_surfaceMarkers[x * m_height + y] };
+			Node& node = m_nodes[m_grid.index(x, y)];
+			node.addMarkers(column, 2, m_maxHeight);
+			// Fill all nodes to a basic "sea level"
+			node.setWaterHeight(m_params.seaLevel);
+		}
+	}
+}
 
-			float maxHeightScaled = height / m_maxHeight;
+void Map::addRocksAndDirt(PerlinNoise* noises)
+{
+	placeSurfaces();
 
-			// Place a tree
-			if (rand() % m_params.treeGenerationRarity == 0)
-				trySpawnTree(glm::vec2(x, y));
+	// F=pV so resistivity and resistivity are linearly related
+	float completion = 0.0f;
+	m_subsurface = std::make_shared<Subsurface>(noises[NoiseType_Resistivity], noises[NoiseType_Rock], m_params, m_maxHeight);
+	m_columns.setSubsurface(m_subsurface.get(), m_nodes, &m_grid);
 
-			// Peak heights can be springs, spawning water constantly
-			if (maxHeightScaled >= m_params.springThreshold && height > m_params.minimumSpringHeight &&  rand() % m_params.springRarity == 0)
-				addSpring(x, y);
+	// Every column can get at most one marker per layer, so the store never has to regrow past this
+	int maxMarkers = m_columns.getSize();
+	for (int i = 0; i < m_width * m_height; ++i)
+	{
+		const glm::ivec2 layers = m_subsurface->getInitialLayers(m_nodes[i].topHeight());
+		maxMarkers += m_nodes[i].getMarkerCount() + layers.y - layers.x;
+	}
+	m_columns.reserve(maxMarkers);
+
+	if (!m_threads)
+		m_threads.reset(new ThreadPool(m_params.workerThreads));
 
-			for (float currHeight = 0.0f; currHeight < maxHeightScaled; currHeight += incrementValue)
+	// The layers of every column in a band are sampled across the pool, each row into its own list, so
+	// that only the noise runs in parallel. The columns themselves are built in order.
+	std::vector<std::vector<glm::ivec2>> rowRanges(GENERATION_BAND, std::vector<glm::ivec2>(m_height));
+	std::vector<std::vector<NodeMarker>> rowLayers(GENERATION_BAND);
+	std::vector<std::vector<int>> rowStarts(GENERATION_BAND);
+
+	for (int band = 0; band < m_width; band += GENERATION_BAND)
+	{
+		const int bandWidth = glm::min(GENERATION_BAND, m_width - band);
+		m_threads->run(bandWidth, [&](int row)
+		{
+			std::vector<glm::ivec2>& ranges = rowRanges[row];
+			for (int y = 0; y < m_height; ++y)
+				ranges[y] = m_subsurface->getInitialLayers(getHeightAt(band + row, y));
+			m_subsurface->generate(band + row, 0, m_height, ranges.data(), rowLayers[row], rowStarts[row]);
+		});
+
+		for (int x = band; x < band + bandWidth; ++x)
+		{
+			const std::vector<glm::ivec2>& ranges = rowRanges[x - band];
+			const std::vector<NodeMarker>& layers = rowLayers[x - band];
+			const std::vector<int>& starts = rowStarts[x - band];
+			for (int y = 0; y < m_height; ++y)
 			{
-				if (currHeight * m_maxHeight < BEDROCK_SAFETY_LAYER)
-					continue;
+				Node& node = m_nodes[m_grid.index(x, y)];
+				node.addMarkers(layers.data() + starts[y], starts[y + 1] - starts[y], m_maxHeight);
+				if (ranges[y].x > 0)
+					node.deferLayers(ranges[y].x);
+			}
 
-				const float scaledHeight = currHeight * m_params.rockVerticalScaling;
-				if (!isRock)
-				{
-					// rock resistiveForce (3.8-4.2g/cm3)
-					float currVal = rockNoise->noise(x / (m_params.rockRarity / m_params.scale), y / (m_params.rockRarity / m_params.scale), scaledHeight);
-					if (currVal > m_params.rockThreshold)
-					{
-						float resistivity = m_params.rockResistivityBase + (currVal - m_params.rockThreshold) * m_params.rockResistivityVariance;
-						m_nodes[y * m_width + x].addMarker(currHeight * m_maxHeight, resistivity, true, glm::vec3(0.1f, 0.1f, 0.1f) + glm::vec3(0.5f, 0.5f, 0.5f) * currVal, 0.0f, 0.0f, 0.0f, m_maxHeight);
-						isRock = true;
-					}
-					else
-					{
-						// soil resistiveForce (2.3-2.6g/cm3, increasing with depth)
-						float noise = resistivityNoise->noise(x / (m_params.soilResistivityChangeRate / m_params.scale), y / (m_params.soilResistivityChangeRate / m_params.scale), scaledHeight);
-						float resistivity = m_params.soilResistivityBase + glm::max(0.0f, 0.5f - currHeight) + noise * m_params.soilResistivityVariance;
-						float sandAmount = m_params.soilSandContent + noise * m_params.soilSandVariance;
-						float clayAmount = m_params.soilClayContent + noise * m_params.soilClayVariance;
-						glm::vec3 col = glm::vec3(0.2f + noise * 0.2f, 0.3f, 0.0f);
-						m_nodes[y * m_width + x].addMarker(currHeight * m_maxHeight, resistivity, false, col, m_params.soilFertility, sandAmount, clayAmount, m_maxHeight);
-					}
-				}
+			float prevCompletion = completion;
+			completion = (x / (float)m_width) * 100.0f;
+			if ((int)completion % 10 < (int)prevCompletion % 10)
+			{
+				if (prevCompletion < 10.0f)
+					std::cout << "Placing Rocks and Dirt: " << completion << "%";
 				else
-				{
-					// rock resistiveForce (3.8-4.2g/cm3)
-					float currVal = rockNoise->noise(x / (m_params.rockRarity / m_params.scale), y / (m_params.rockRarity / m_params.scale), scaledHeight);
-					if (currVal < m_params.rockThreshold)
-					{
-						float resistivity = m_params.rockResistivityBase + (currVal - m_params.rockThreshold) * m_params.rockResistivityVariance;
-						m_nodes[y * m_width + x].addMarker(currHeight * m_maxHeight, resistivity, true, glm::vec3(0.1f, 0.1f, 0.1f) + glm::vec3(0.5f, 0.5f, 0.5f) * currVal, 0.0f, 0.0f, 0.0f, m_maxHeight);
-						isRock = false;
-					}
-				}
+					std::cout << std::string(3, '\b') << completion << "%";
 			}
 		}
+	}
+	std::cout << std::string(3, '\b') << "100 %";
+	std::cout << std::endl;
 
-		float prevCompletion = completion;
-		completion = (x / (float)m_width) * 100.0f;
-		if ((int)completion % 10 < (int)prevCompletion % 10)
+	// Trim the slack left over from generation
+	m_columns.compact(m_nodes, m_width * m_height);
+}
+
+void Map::placeTrees()
+{
+	for (int i = 0; i < m_width * m_height; ++i)
+	{
+		m_nodes[i].setFoliageDensity(0.0f);
+	}
+
+	for (int x = 0; x < m_width; ++x)
+	{
+		for (int y = 0; y < m_height; ++y)
 		{
-			if (prevCompletion < 10.0f)
-				std::cout << "Placing Rocks, Trees, and Dirt: " << completion << "%";
-			else
-				std::cout << std::string(3, '\b') << completion << "%";
+			if (m_random.range(RandomStage_Tree, glm::ivec2(x, y), 0, m_params.treeGenerationRarity) == 0)
+				trySpawnTree(glm::vec2(x, y));
+		}
+	}
+}
+
+void Map::placeSprings()
+{
+	m_springs.clear();
+	for (int x = 0; x < m_width; ++x)
+	{
+		for (int y = 0; y < m_height; ++y)
+		{
+			float height = getHeightAt(x, y);
+			float maxHeightScaled = height / m_maxHeight;
+
+			// Peak heights can be springs, spawning water constantly
+			if (maxHeightScaled >= m_params.springThreshold && height > m_params.minimumSpringHeight && m_random.range(RandomStage_Spring, glm::ivec2(x, y), 0, m_params.springRarity) == 0)
+				addSpring(x, y);
 		}
 	}
-	std::cout << std::string(3, '\b') << "100 %";
-	std::cout << std::endl;
 }
 
 void Map::defineSoils()
@@ -275,28 +781,25 @@ void Map::addSpring(int x, int y)
 	m_springs.push_back(glm::vec2(x, y));
 }
 
-float Map::getHillValue(PerlinNoise* noise, int x, int y, float hillHeight, float rarity)
+float Map::getHillValue(double noise, double varianceNoise, float hillHeight)
 {
-	glm::vec2 XY = calculateXYFromRarity(x, y, rarity);
-	float hillVal = (noise->noise(XY.x, XY.y, m_params.noiseSampleHeight) - 0.1f) * glm::pow(noise->noise(XY.x, XY.y, m_params.noiseSampleHeight * 2.0f), m_params.hillVariancePower);
+	float hillVal = (noise - 0.1f) * glm::pow(varianceNoise, m_params.hillVariancePower);
 	return hillVal * hillHeight / m_params.scale;
 }
 
-float Map::getDivetValue(PerlinNoise* noise, int x, int y, float divetHeight, float rarity)
+float Map::getDivetValue(double noise, float divetHeight)
 {
-	glm::vec2 XY = calculateXYFromRarity(x, y, rarity);
-	float divetVal = -(float)noise->noise(XY.x, XY.y, m_params.noiseSampleHeight);
+	float divetVal = -(float)noise;
 	return divetVal * divetHeight / m_params.scale;
 }
 
-float Map::getMountainValue(PerlinNoise* noise, int x, int y, float mountainHeight, float rarity)
+float Map::getMountainValue(double noise, float mountainHeight)
 {
-	glm::vec2 XY = calculateXYFromRarity(x, y, rarity);
 	float mountainVal = 0.0f;
-	bool mountain = noise->noise(XY.x, XY.y, m_params.noiseSampleHeight) > m_params.mountainThreshold;
+	bool mountain = noise > m_params.mountainThreshold;
 	if (mountain)
 	{
-		mountainVal += pow((noise->noise(XY.x, XY.y, m_params.noiseSampleHeight) - m_params.mountainThreshold) * sqrt(mountainHeight) * m_params.mountainConstantMultiplier / m_params.scale, 2);
+		mountainVal += pow((noise - m_params.mountainThreshold) * sqrt(mountainHeight) * m_params.mountainConstantMultiplier / m_params.scale, 2);
 	}
 	return mountainVal;
 }
@@ -317,24 +820,7 @@ glm::vec2 Map::calculateXYFromRarity(int x, int y, float rarity)
 
 Node* Map::getNodeAt(int x, int y)
 {
-	if (y >= m_height)
-	{
-		return getNodeAt(x, fmin(y, m_height - 1));
-	}
-	if (x >= m_width)
-	{
-		return getNodeAt(fmin(x, m_width - 1), y);
-	}
-	if (x < 0)
-	{
-		return getNodeAt(0, y);
-	}
-	if (y < 0)
-	{
-		return getNodeAt(x, 0);
-	}
-
-	return &m_nodes[y * m_width + x];
+	return &m_nodes[m_grid.index(glm::clamp(x, 0, m_width - 1), glm::clamp(y, 0, m_height - 1))];
 }
 
 float Map::getHeightAt(int x, int y)
@@ -378,6 +864,7 @@ float Map::getDensityAt(int x, int y, float height)
 // Debug function. Removes top layer of every node, to test resistiveForce values etc. without erosion
 void Map::skimTop()
 {
+	m_changedSinceGeneration = true;
 	for (int x = 0; x < m_width; ++x)
 	{
 		for (int y = 0; y < m_height; ++y)
@@ -385,11 +872,13 @@ void Map::skimTop()
 			getNodeAt(x, y)->skim();
 		}
 	}
+	m_lakes.clear(&m_grid);
 }
 
 // Debug function. Erodes everything, to test erosion.
 void Map::erodeAllByValue(float amount)
 {
+	m_changedSinceGeneration = true;
 	for (int x = 0; x < m_width; ++x)
 	{
 		for (int y = 0; y < m_height; ++y)
@@ -398,6 +887,19 @@ void Map::erodeAllByValue(float amount)
 			getNodeAt(x, y)->setWaterHeight(0.0f);
 		}
 	}
+	m_lakes.clear(&m_grid);
+}
+
+Map::Map(const MapSnapshot& snapshot, MapParams params)
+{
+	defineSoils();
+	m_width = snapshot.width;
+	m_height = snapshot.height;
+	m_params = params;
+	m_params.tiledNodeLayout = snapshot.tiled;
+	m_grid.build(m_width, m_height, snapshot.tiled);
+	m_nodes = new Node[m_width * m_height];
+	rollback(snapshot);
 }
 
 Map::~Map()
@@ -405,6 +907,68 @@ Map::~Map()
 	delete[m_width * m_height] m_nodes;
 }
 
+std::shared_ptr<const MapSnapshot> Map::snapshot()
+{
+	const int count = m_width * m_height;
+
+	// Freeze whatever has been written since the last snapshot, so it can be shared too
+	if (m_columns.getSize() > 0)
+	{
+		if (m_columns.shouldCompact())
+			m_columns.compact(m_nodes, count);
+		m_sharedColumns.push_back(m_columns.freeze(m_nodes, count));
+	}
+
+	// Stores whose columns have all been copied out again aren't needed any more
+	std::unordered_set<const ColumnStore*> used;
+	for (int i = 0; i < count; ++i)
+	{
+		used.insert(m_nodes[i].getStore());
+	}
+	m_sharedColumns.erase(std::remove_if(m_sharedColumns.begin(), m_sharedColumns.end(), [&](const std::shared_ptr<ColumnStore>& store) { return used.count(store.get()) == 0; }), m_sharedColumns.end());
+
+	std::shared_ptr<MapSnapshot> snapshot = std::make_shared<MapSnapshot>();
+	snapshot->width = m_width;
+	snapshot->height = m_height;
+	snapshot->tiled = m_grid.isTiled();
+	snapshot->age = m_age;
+	snapshot->growth = m_growth;
+	snapshot->seed = m_random.getSeed();
+	snapshot->maxHeight = m_maxHeight;
+	snapshot->nodes.assign(m_nodes, m_nodes + count);
+	snapshot->springs = m_springs;
+	snapshot->columns = m_sharedColumns;
+	snapshot->subsurface = m_subsurface;
+
+	// Lakes aren't kept in snapshots, so the map carries on without them too, just as its forks and rollbacks do
+	m_lakes.clear(&m_grid);
+	return snapshot;
+}
+
+void Map::rollback(const MapSnapshot& snapshot)
+{
+	if (snapshot.width != m_width || snapshot.height != m_height || snapshot.tiled != m_grid.isTiled())
+	{
+		std::cout << "Can't roll back to a snapshot of a differently laid out map" << std::endl;
+		return;
+	}
+
+	// Every column of the snapshot is frozen, so the map's own store starts empty
+	std::copy(snapshot.nodes.begin(), snapshot.nodes.end(), m_nodes);
+	m_columns = ColumnStore();
+	m_columns.adopt(m_nodes, m_width * m_height);
+	m_sharedColumns = snapshot.columns;
+	m_age = snapshot.age;
+	m_growth = snapshot.growth;
+	m_random = Random(snapshot.seed);
+	m_maxHeight = snapshot.maxHeight;
+	m_springs = snapshot.springs;
+	m_subsurface = snapshot.subsurface;
+	m_columns.setSubsurface(m_subsurface.get(), m_nodes, &m_grid);
+	m_lakes.clear(&m_grid);
+	m_changedSinceGeneration = true;
+}
+
 std::string Map::getMapGeneralSoilType()
 {
 	std::ostringstream oss;
@@ -443,6 +1007,24 @@ int Map::getSoilTypeBestMatching(NodeMarker* nodeData, float& bestCertainty)
 	int bestIndex = -1;
 	bestCertainty = 0.0f;
 
+#ifdef COMPACT_MARKERS
+	// Markers are only as precise as the palette's bins, so each bin only needs classifying once
+	if (m_columns.palette.findSoilType(*nodeData, bestIndex, bestCertainty))
+		return bestIndex;
+
+	NodeMarker binned = MaterialPalette::quantize(*nodeData);
+	for (int i = 0; i < m_soilDefinitions.size(); i++)
+	{
+		float certainty = m_soilDefinitions[i].getCertainty(&binned);
+		if (certainty > bestCertainty)
+		{
+			bestCertainty = certainty;
+			bestIndex = i;
+		}
+	}
+
+	m_columns.palette.cacheSoilType(*nodeData, bestIndex, bestCertainty);
+#else
 	for (int i = 0; i < m_soilDefinitions.size(); i++)
 	{
 		float certainty = m_soilDefinitions[i].getCertainty(nodeData);
@@ -452,6 +1034,7 @@ int Map::getSoilTypeBestMatching(NodeMarker* nodeData, float& bestCertainty)
 			bestIndex = i;
 		}
 	}
+#endif
 
 	return bestIndex;
 }
@@ -490,9 +1073,9 @@ std::string Map::getSoilType(glm::vec2 pos)
 std::string Map::stats(glm::vec2 pos)
 {
 	std::ostringstream oss;
-	glm::vec3 norm = normal(pos.y * m_width + pos.x);
+	glm::vec3 norm = normal(m_grid.at(pos.x, pos.y));
 	glm::vec3 col = getNodeAt(pos.x, pos.y)->topColor();
-	glm::vec3 col2 = getNodeAt(pos.x, pos.y)->top()->color;
+	glm::vec3 col2 = getNodeAt(pos.x, pos.y)->top().color;
 	oss << "Node data at pos " << pos.x << ", " << pos.y << ": \n Land height = " << getNodeAt(pos.x, pos.y)->topHeight() << std::endl;
 	oss << " Pool = " << getNodeAt(pos.x, pos.y)->waterDepth() << std::endl << " Stream = " << getNodeAt(pos.x, pos.y)->getParticles() << std::endl << " Foliage = " << getNodeAt(pos.x, pos.y)->getFoliageDensity();
 	oss << " Normal is " << norm.x << ", " << norm.y << ", " << norm.z << std::endl << " Color (with foliage and particles) is " << col.x << ", " << col.y << ", " << col.z << std::endl << " Node color is " << col2.x << ", " << col2.y << ", " << col2.z << std::endl;
@@ -503,54 +1086,71 @@ std::string Map::stats(glm::vec2 pos)
 void Map::erode(int cycles) 
 {
 	m_age++;
+	m_changedSinceGeneration = true;
 	// Track all particle movement
 	bool* track = new bool[m_width * m_height];
 	std::fill(track, track + m_width * m_height, false);
-	glm::vec2 dim = glm::vec2(m_width, m_height);
-	int springIndex = 0;
-	float completion = 0.0f;
-
-	for (int currentCycle = 0; currentCycle < cycles; currentCycle++)
+	m_floodFill.setArea(&m_grid, glm::ivec4(0, 0, m_width, m_height));
+	m_depressions.build(m_nodes, &m_grid);
+	if (m_params.erosionTileSize > 0)
 	{
-		// Spawn particle
-		glm::vec2 newParticlePos = glm::vec2(rand() % m_width, rand() % m_height);
+		erodeOnTiles(cycles, track);
+	}
+	else
+	{
+		int springIndex = 0;
+		float completion = 0.0f;
 
-		// Spawn at spring if possible
-		if (springIndex < m_springs.size())
+		for (int currentCycle = 0; currentCycle < cycles; currentCycle++)
 		{
-			newParticlePos = m_springs.at(springIndex);
-			springIndex++;
-		}
+			// Spawn particle
+			glm::vec2 newParticlePos = glm::vec2(m_random.range(RandomStage_DropX, glm::ivec2(currentCycle, 0), m_age, m_width), m_random.range(RandomStage_DropY, glm::ivec2(currentCycle, 0), m_age, m_height));
 
-		Drop drop(newParticlePos, &m_params);
+			// Spawn at spring if possible
+			if (springIndex < m_springs.size())
+			{
+				newParticlePos = m_springs.at(springIndex);
+				springIndex++;
+			}
 
-		// If we've moved 1km, give up.
-		while (drop.getVolume() > drop.getMinVolume() && drop.getAge() < 1000) {
+			Drop drop(newParticlePos, &m_params);
 
-			if (!drop.descend(normal((int)drop.getPosition().y * m_width + (int)drop.getPosition().x), m_nodes, track, dim, m_maxHeight) && drop.getVolume() > drop.getMinVolume())
-			{
-				if (!drop.flood(m_nodes, dim, m_maxHeight))
-					break;
+			// If we've moved 1km, give up.
+			while (drop.getVolume() > drop.getMinVolume() && drop.getAge() < 1000) {
+
+				if (!drop.descend(normal(m_grid.index((int)drop.getPosition().x, (int)drop.getPosition().y)), m_nodes, m_grid, track, m_maxHeight) && drop.getVolume() > drop.getMinVolume())
+				{
+					if (!drop.flood(m_nodes, m_grid, m_maxHeight, m_floodFill, m_depressions, m_lakes))
+						break;
+				}
 			}
-		}
 
-		// If we've terminated for whatever reason, immediately try and flood
-		if (drop.getAge() >= 1000)
-			drop.flood(m_nodes, dim, m_maxHeight);
+			// If we've terminated for whatever reason, immediately try and flood
+			if (drop.getAge() >= 1000)
+				drop.flood(m_nodes, m_grid, m_maxHeight, m_floodFill, m_depressions, m_lakes);
+			drop.reportChanges(m_lakes, glm::ivec4(0, 0, m_width, m_height));
 
-		float prevCompletion = completion;
-		completion = (currentCycle / (float)cycles) * 100.0f;
-		if ((int)completion % 10 < (int)prevCompletion % 10)
-		{
-			if (prevCompletion < 10.0f)
-				std::cout << "Running water simulation: " << completion << "%";
-			else
-				std::cout << std::string(3, '\b') << completion << "%";
+			float prevCompletion = completion;
+			completion = (currentCycle / (float)cycles) * 100.0f;
+			if ((int)completion % 10 < (int)prevCompletion % 10)
+			{
+				if (prevCompletion < 10.0f)
+					std::cout << "Running water simulation: " << completion << "%";
+				else
+					std::cout << std::string(3, '\b') << completion << "%";
+			}
 		}
 	}
 	std::cout << std::string(3, '\b') << "100 %";
 	std::cout << std::endl;
 
+	if (m_params.markerCoalesceTolerance > 0.0f)
+		coalesceTouched();
+
+	// Reclaim the slots left behind by columns that grew
+	if (m_columns.shouldCompact())
+		m_columns.compact(m_nodes, m_width * m_height);
+
 	// Travelled nodes can be filled outwards for wider, more effective-looking rivers
 	int riverWidth = m_params.dropWidth * 2 + 1;
 	for (int i = 0; i < m_width * m_height; i++)
@@ -558,12 +1158,15 @@ void Map::erode(int cycles)
 		if (track[i])
 		{
 			float h = m_nodes[i].topHeight() + 1.0f;
+			const glm::ivec2 pos = m_grid.position(i);
+			Node* edge = getNodeAt(pos.x - m_params.dropWidth, pos.y - m_params.dropWidth);
+			const float spread = glm::min(1.0f, glm::max(0.0f, h - m_nodes[i].topHeight()));
 
 			for (int yOffset = 0; yOffset < riverWidth; yOffset++)
 			{
 				for (int xOffset = 0; xOffset < riverWidth; xOffset++)
 				{
-					getNodeAt(i % m_width - m_params.dropWidth, i / m_width - m_params.dropWidth)->setParticles(getNodeAt(i % m_width - m_params.dropWidth, i / m_width - m_params.dropWidth)->getParticles() + glm::min(1.0f, glm::max(0.0f, h - getNodeAt(i % m_width, i / m_width)->topHeight())));
+					edge->setParticles(edge->getParticles() + spread);
 				}
 			}
 
@@ -578,12 +1181,189 @@ void Map::erode(int cycles)
 	delete[m_width * m_height] track;
 }
 
+void Map::erodeOnTiles(int cycles, bool* track)
+{
+	if (!m_threads)
+		m_threads.reset(new ThreadPool(m_params.workerThreads));
+
+	const int tileSize = glm::max(m_params.erosionTileSize, EROSION_MIN_TILE_SIZE);
+	const glm::ivec2 tiles((m_width + tileSize - 1) / tileSize, (m_height + tileSize - 1) / tileSize);
+	const int tileCount = tiles.x * tiles.y;
+	// Pools on tiles running at the same time can spread almost half the gap between the tiles, leaving room either side for drops to reach
+	const int poolReach = tileSize / 2 - EROSION_DROP_REACH / 2;
+	auto tileAt = [&](glm::vec2 pos) { return ((int)pos.y / tileSize) * tiles.x + (int)pos.x / tileSize; };
+
+	// Drops are spawned just as they are when run one after another
+	std::vector<Drop> drops;
+	drops.reserve(cycles);
+	for (int currentCycle = 0; currentCycle < cycles; currentCycle++)
+	{
+		glm::vec2 newParticlePos = glm::vec2(m_random.range(RandomStage_DropX, glm::ivec2(currentCycle, 0), m_age, m_width), m_random.range(RandomStage_DropY, glm::ivec2(currentCycle, 0), m_age, m_height));
+		if (currentCycle < m_springs.size())
+			newParticlePos = m_springs.at(currentCycle);
+		drops.push_back(Drop(newParticlePos, &m_params));
+	}
+
+	// What each tile has to run, and what it hands on once it has run. Tiles only touch their own.
+	std::vector<std::vector<int>> waiting(tileCount);
+	std::vector<std::vector<int>> leaving(tileCount);
+	std::vector<std::vector<int>> flooding(tileCount);
+	std::vector<int> finishedOn(tileCount, 0);
+	std::vector<float> maxHeights(tileCount);
+	// Columns changed on a tile are copied into a store of its own, as other tiles are running at the same time
+	std::vector<ColumnStore> stores(tileCount);
+	// Nodes changed on a tile whose lakes reach past its area, to forget once no tiles are running
+	std::vector<std::vector<int>> unresolved(tileCount);
+	for (int i = 0; i < cycles; i++)
+		waiting[tileAt(drops[i].getPosition())].push_back(i);
+
+	std::vector<int> running;
+	std::vector<int> pools;
+	int finished = 0;
+	float completion = 0.0f;
+	while (finished < cycles)
+	{
+		for (int phase = 0; phase < 4; phase++)
+		{
+			running.clear();
+			for (int y = phase / 2; y < tiles.y; y += 2)
+			{
+				for (int x = phase % 2; x < tiles.x; x += 2)
+				{
+					if (!waiting[y * tiles.x + x].empty())
+						running.push_back(y * tiles.x + x);
+				}
+			}
+
+			m_threads->run((int)running.size(), [&](int task)
+			{
+				const int tile = running[task];
+				const glm::ivec2 corner = glm::ivec2(tile % tiles.x, tile / tiles.x) * tileSize;
+				const glm::ivec4 bounds(corner, glm::min(corner + tileSize, glm::ivec2(m_width, m_height)));
+				float maxHeight = m_maxHeight;
+				FloodFill fill;
+				fill.setArea(&m_grid, bounds + glm::ivec4(-poolReach, -poolReach, poolReach, poolReach));
+
+				// Drops handed over from other tiles still run in the order they were spawned
+				std::sort(waiting[tile].begin(), waiting[tile].end());
+				ColumnStore::redirect(&stores[tile]);
+				Lakes::redirect(&unresolved[tile]);
+				for (int drop : waiting[tile])
+				{
+					dropProgress progress = runDropOnTile(drops[drop], bounds, fill, track, maxHeight);
+					if (progress == DropProgress_LeftTile)
+						leaving[tile].push_back(drop);
+					else if (progress == DropProgress_Flooding)
+						flooding[tile].push_back(drop);
+					else
+						finishedOn[tile]++;
+				}
+				ColumnStore::redirect(nullptr);
+				Lakes::redirect(nullptr);
+
+				waiting[tile].clear();
+				maxHeights[tile] = maxHeight;
+			});
+
+			for (int tile : running)
+			{
+				m_maxHeight = glm::max(m_maxHeight, maxHeights[tile]);
+				for (int drop : leaving[tile])
+					waiting[tileAt(drops[drop].getPosition())].push_back(drop);
+				pools.insert(pools.end(), flooding[tile].begin(), flooding[tile].end());
+				finished += finishedOn[tile];
+				for (int node : unresolved[tile])
+					m_lakes.forget(node, glm::ivec4(0, 0, m_width, m_height));
+				leaving[tile].clear();
+				flooding[tile].clear();
+				unresolved[tile].clear();
+				finishedOn[tile] = 0;
+			}
+		}
+
+		// Pools bigger than a tile could reach anywhere, so are only formed while no tiles are running
+		std::sort(pools.begin(), pools.end());
+		for (int drop : pools)
+			drops[drop].flood(m_nodes, m_grid, m_maxHeight, m_floodFill, m_depressions, m_lakes);
+		finished += (int)pools.size();
+		pools.clear();
+
+		float prevCompletion = completion;
+		completion = (finished / (float)cycles) * 100.0f;
+		if ((int)completion / 10 > (int)prevCompletion / 10)
+		{
+			if (prevCompletion < 10.0f)
+				std::cout << "Running water simulation on " << tileCount << " tiles: " << completion << "%";
+			else
+				std::cout << std::string(3, '\b') << completion << "%";
+		}
+	}
+
+	for (ColumnStore& store : stores)
+		store.returnColumns();
+}
+
+dropProgress Map::runDropOnTile(Drop& drop, glm::ivec4 tile, FloodFill& fill, bool* track, float& maxHeight)
+{
+	bool flood = false;
+
+	// If we've moved 1km, give up.
+	while (drop.getVolume() > drop.getMinVolume() && drop.getAge() < 1000)
+	{
+		if (!drop.descend(normal(m_grid.index((int)drop.getPosition().x, (int)drop.getPosition().y)), m_nodes, m_grid, track, maxHeight))
+		{
+			flood = drop.getVolume() > drop.getMinVolume();
+			break;
+		}
+
+		const glm::ivec2 pos(drop.getPosition());
+		if (pos.x < tile.x || pos.y < tile.y || pos.x >= tile.z || pos.y >= tile.w)
+		{
+			drop.reportChanges(m_lakes, fill.getArea());
+			return DropProgress_LeftTile;
+		}
+	}
+
+	// If we've terminated for whatever reason, immediately try and flood
+	if (drop.getAge() >= 1000)
+		flood = true;
+
+	drop.reportChanges(m_lakes, fill.getArea());
+
+	if (flood && drop.flood(m_nodes, m_grid, maxHeight, fill, m_depressions, m_lakes))
+		return DropProgress_Flooding;
+
+	return DropProgress_Finished;
+}
+
+void Map::coalesceTouched()
+{
+	int columns = 0;
+	int before = 0;
+	int after = 0;
+
+	for (int i = 0; i < m_width * m_height; i++)
+	{
+		before += m_nodes[i].getMarkerCount();
+		if (m_nodes[i].isTouched())
+		{
+			m_nodes[i].coalesce(m_params.markerCoalesceTolerance);
+			columns++;
+		}
+		after += m_nodes[i].getMarkerCount();
+	}
+
+	std::cout << "Coalesced " << columns << " changed columns: " << before << " markers before, " << after << " after" << std::endl;
+}
+
 void Map::grow()
 {
+	m_changedSinceGeneration = true;
+	m_growth++;
 	// Spawn a tree randomly on the map (long-distance fertilization)
 	for (int i = 0; i < m_params.treeLongDistanceFertilizationCount; i++)
 	{
-		int newTreePos = rand() % (m_width * m_height);
+		int newTreePos = m_random.range(RandomStage_LongDistanceTree, glm::ivec2(i, 0), m_growth, m_width * m_height);
 		trySpawnTree(glm::vec2(newTreePos % m_width, newTreePos / m_width));
 	}
 
@@ -594,16 +1374,17 @@ void Map::grow()
 		// Tree spawns a new tree
 		if (m_nodes[i].getFoliageDensity() > 0.5f)
 		{
-			if (rand() % m_params.treeSpreadChance == 0)
+			const glm::ivec2 pos = m_grid.position(i);
+			if (m_random.range(RandomStage_TreeSpread, pos, m_growth, m_params.treeSpreadChance) == 0)
 			{
-				glm::vec2 newPlantPos = glm::vec2(i % m_width, i / m_width) + glm::vec2(rand() % m_params.treeSpreadRadius - (m_params.treeSpreadRadius / 2), rand() % m_params.treeSpreadRadius - (m_params.treeSpreadRadius / 2));
+				glm::vec2 newPlantPos = glm::vec2(pos) + glm::vec2(m_random.range(RandomStage_TreeSpreadX, pos, m_growth, m_params.treeSpreadRadius) - (m_params.treeSpreadRadius / 2), m_random.range(RandomStage_TreeSpreadY, pos, m_growth, m_params.treeSpreadRadius) - (m_params.treeSpreadRadius / 2));
 				trySpawnTree(newPlantPos);
 			}
 
 			// Trees die in water & sometimes die randomly
-			if (m_nodes[i].waterDepth() > 0.0 || m_nodes[i].getParticles() > m_params.treeParticleDeathThreshold || rand() % m_params.treeRandomDeathChance == 0)
+			if (m_nodes[i].waterDepth() > 0.0 || m_nodes[i].getParticles() > m_params.treeParticleDeathThreshold || m_random.range(RandomStage_TreeDeath, pos, m_growth, m_params.treeRandomDeathChance) == 0)
 			{
-				Plant::root(m_nodes, glm::vec2(m_width, m_height), glm::vec2(i % m_width, i / m_width), -1.0f);
+				Plant::root(m_nodes, m_grid, pos, -1.0f);
 			}
 		}
 
@@ -626,7 +1407,7 @@ bool Map::trySpawnTree(glm::vec2 pos)
 	if (pos.x < 0 || pos.x >= m_width || pos.y < 0 || pos.y >= m_height)
 		return false;
 
-	int index = pos.y * m_width + pos.x;
+	int index = m_grid.index(pos.x, pos.y);
 
 	if (m_nodes[index].getFoliageDensity() >= m_params.foliageOverpopulationThreshold)
 		return false;
@@ -641,6 +1422,6 @@ bool Map::trySpawnTree(glm::vec2 pos)
 	if (abs(norm.z) < m_params.treeSlopeThreshold)
 		return false;
 
-	Plant::root(m_nodes, glm::vec2(m_width, m_height), pos, 0.5f);
+	Plant::root(m_nodes, m_grid, pos, 0.5f);
 	return true;
 }
\ No newline at end of file
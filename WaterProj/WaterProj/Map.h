@@ -3,19 +3,38 @@
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <SDL2/SDL.h>
 #include <string>
 #include <time.h>
 #include <Windows.h>
 
+#include "Depressions.h"
+#include "FloodFill.h"
+#include "HaloGrid.h"
+#include "Lakes.h"
 #include "Node.h"
 #include "Plant.h"
+#include "Random.h"
 
 //#define FLOODTESTMAP
 #define BEDROCK_LAYER 0.0f
 #define BEDROCK_SAFETY_LAYER 0.1f
-
+// The number of rows of nodes generated in parallel at a time, before being written to the map in order
+#define GENERATION_BAND 16
+// Saved worlds from any other version are generated again. Raise this whenever a change alters the worlds generated.
+#define WORLD_CACHE_VERSION 1
+// How far past the edge of its tile a drop running on the tile can read or change the map, looking back along the last
+// ten steps of its path. Tiles run at the same time are a whole tile apart, so nothing one reaches is reached by another.
+#define EROSION_DROP_REACH 16
+// The smallest tile drops are run on, so that drops on tiles running at the same time can't reach the same nodes
+#define EROSION_MIN_TILE_SIZE (EROSION_DROP_REACH * 2)
+
+class Drop;
+class NoiseCache;
 class PerlinNoise;
+class Subsurface;
+class ThreadPool;
 
 /***************************************************************************//**
  * Defines for the type of noise within the array of generated noise. Mostly
@@ -33,6 +52,51 @@ enum noiseType : int
 	NoiseType_Sand,
 };
 
+/***************************************************************************//**
+ * Defines for the low frequency noise that can be cached during generation.
+ ******************************************************************************/
+enum cachedNoise : int
+{
+	CachedNoise_Lie,
+	CachedNoise_Hill,
+	// The hill noise at twice the height, varying the shape of hills
+	CachedNoise_HillVariance,
+	CachedNoise_Divet,
+	CachedNoise_Mountain,
+	CachedNoise_Count,
+};
+
+/***************************************************************************//**
+ * The stages map generation is split into, in the order they run. Each stage
+ * only reads the parameters listed for it in Map.cpp and what the stages
+ * before it produced, so changing a parameter only needs the stages from the
+ * first that reads it to be run again.
+ ******************************************************************************/
+enum generationStage : int
+{
+	// Surface heights from the terrain noise
+	GenerationStage_Heightfield,
+	// Sand or topsoil on top of each surface
+	GenerationStage_Surface,
+	// The columns of every node, from the surface down to bedrock
+	GenerationStage_RocksAndDirt,
+	GenerationStage_Trees,
+	GenerationStage_Springs,
+	GenerationStage_Count,
+};
+
+/***************************************************************************//**
+ * How far a drop got while running on a tile.
+ ******************************************************************************/
+enum dropProgress : int
+{
+	DropProgress_Finished,
+	// Stepped onto another tile, which it continues on when that tile next runs
+	DropProgress_LeftTile,
+	// Started a pool too big for the tile, which is finished once no tiles are running
+	DropProgress_Flooding,
+};
+
 /***************************************************************************//**
  * MapParams define all tweakable values for the program. Loaded from a map config
  * file (named "params" by defaut)
@@ -49,6 +113,12 @@ struct MapParams
 	{
 		floatPropertyMap.emplace(std::pair<std::string, float&>("noiseSampleHeight", noiseSampleHeight));
 		intPropertyMap.emplace(std::pair<std::string, int&>("scale", scale));
+		intPropertyMap.emplace(std::pair<std::string, int&>("tiledNodeLayout", tiledNodeLayout));
+		intPropertyMap.emplace(std::pair<std::string, int&>("workerThreads", workerThreads));
+		intPropertyMap.emplace(std::pair<std::string, int&>("erosionTileSize", erosionTileSize));
+		intPropertyMap.emplace(std::pair<std::string, int&>("noiseCacheDensity", noiseCacheDensity));
+		intPropertyMap.emplace(std::pair<std::string, int&>("validateNoiseCache", validateNoiseCache));
+		intPropertyMap.emplace(std::pair<std::string, int&>("worldCache", worldCache));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("baseVariance", baseVariance));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("lieChangeRate", lieChangeRate));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("liePeak", liePeak));
@@ -66,6 +136,8 @@ struct MapParams
 		floatPropertyMap.emplace(std::pair<std::string, float&>("mountainConstantMultiplier", mountainConstantMultiplier));
 
 		intPropertyMap.emplace(std::pair<std::string, int&>("generatedMapDensity", generatedMapDensity));
+		floatPropertyMap.emplace(std::pair<std::string, float&>("lazySubsurfaceDepth", lazySubsurfaceDepth));
+		floatPropertyMap.emplace(std::pair<std::string, float&>("generatedMarkerTolerance", generatedMarkerTolerance));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("soilResistivityChangeRate", soilResistivityChangeRate));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("soilResistivityBase", soilResistivityBase));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("soilResistivityVariance", soilResistivityVariance));
@@ -108,9 +180,8 @@ struct MapParams
 		floatPropertyMap.emplace(std::pair<std::string, float&>("dropContainedSedimentCap", dropContainedSedimentCap));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("particleTerminationProximity", particleTerminationProximity));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("particleSwayMagnitude", particleSwayMagnitude));
-		floatPropertyMap.emplace(std::pair<std::string, float&>("floodDefaultIncrease", floodDefaultIncrease));
-		floatPropertyMap.emplace(std::pair<std::string, float&>("drainErosionAmount", drainErosionAmount));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("poolSedimentLossRate", poolSedimentLossRate));
+		floatPropertyMap.emplace(std::pair<std::string, float&>("markerCoalesceTolerance", markerCoalesceTolerance));
 
 		floatPropertyMap.emplace(std::pair<std::string, float&>("sandHeightVariance", sandHeightVariance));
 		floatPropertyMap.emplace(std::pair<std::string, float&>("minimumSandHeight", minimumSandHeight));
@@ -119,6 +190,22 @@ struct MapParams
 
 		floatPropertyMap.emplace(std::pair<std::string, float&>("bedrockResisitivity", bedrockResisitivity));
 	}
+	/***************************************************************************//**
+	 * Copies the value of every property. The property maps of the copy refer to
+	 * its own properties, rather than to those of the params it was copied from.
+	 ******************************************************************************/
+	MapParams(const MapParams& other) : MapParams()
+	{
+		*this = other;
+	}
+	MapParams& operator=(const MapParams& other)
+	{
+		for (auto& property : floatPropertyMap)
+			property.second = other.floatPropertyMap.at(property.first);
+		for (auto& property : intPropertyMap)
+			property.second = other.intPropertyMap.at(property.first);
+		return *this;
+	}
 
 	std::map<std::string, float&> floatPropertyMap;
 	std::map<std::string, int&> intPropertyMap;
@@ -126,6 +213,20 @@ struct MapParams
 	// NOTE: additional map parameters need to be added to the constructor, filling the property map!
 	float noiseSampleHeight = 0.5f;
 	int scale = 1;
+	// Store nodes in tiles rather than row by row, for better locality on large maps
+	int tiledNodeLayout = 0;
+	// Threads to generate terrain and run tiled erosion with, 0 for one per hardware thread. Doesn't change the results.
+	int workerThreads = 0;
+	// Run drops in parallel on square tiles this many nodes wide, at least EROSION_MIN_TILE_SIZE, or 0 to run them one
+	// after another. Pools are formed as drops reach them rather than strictly in the order drops were spawned.
+	int erosionTileSize = 0;
+	// Lattice points per unit of low frequency noise (lie, hills, divets, mountains) when caching it, 0 to sample every node
+	int noiseCacheDensity = 32;
+	// Sample cached noise directly as well, and report the largest height error the caches caused
+	int validateNoiseCache = 0;
+	// Save generated worlds to disk, and load them rather than generating them again when the seed, size and
+	// generation parameters all match
+	int worldCache = 0;
 	float baseVariance = 0.05f;
 	float lieChangeRate = 3000.0f;
 	float liePeak = 25.0f;
@@ -143,6 +244,12 @@ struct MapParams
 	float mountainConstantMultiplier = 6.6f;
 
 	int generatedMapDensity = 20;
+	// Only generate the layers within this depth of the surface up front, building the rest of a column when something
+	// first reaches below them. 0 to generate every layer up front. Doesn't change the layers generated.
+	float lazySubsurfaceDepth = 0.0f;
+	// Leave out generated soil markers that the markers around them describe to within this, as a fraction. Bounds the
+	// difference in every property against a marker on every layer. 0 to place a marker on every layer.
+	float generatedMarkerTolerance = 0.02f;
 	float soilResistivityChangeRate = 2000.0f;
 	float soilResistivityBase = 2.3f;
 	float soilResistivityVariance = 0.3f;
@@ -185,9 +292,8 @@ struct MapParams
 	float dropContainedSedimentCap = 10.0f;
 	float particleTerminationProximity = 4.0f;
 	float particleSwayMagnitude = 0.05f;
-	float floodDefaultIncrease = 0.01f;
-	float drainErosionAmount = 0.005f;
 	float poolSedimentLossRate = 0.5f;
+	float markerCoalesceTolerance = 0.02f;
 
 	float sandHeightVariance = 0.5f;
 	float sandResistivity = 1.5f;
@@ -197,6 +303,50 @@ struct MapParams
 	float bedrockResisitivity = 7.5f;
 };
 
+/***************************************************************************//**
+ * The coordinates of a batch of noise samples, kept in separate arrays so that
+ * they can be passed straight to PerlinNoise's batched noise, which samples
+ * several at once with SIMD.
+ ******************************************************************************/
+struct NoiseBatch
+{
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> z;
+
+	void resize(int count) { x.resize(count); y.resize(count); z.resize(count); }
+	void set(int index, double sampleX, double sampleY, double sampleZ) { x[index] = sampleX; y[index] = sampleY; z[index] = sampleZ; }
+	/***************************************************************************//**
+	 * Samples noise at every point in the batch.
+	 @param noise The noise to sample
+	 @param values Filled with the noise at each point
+	 ******************************************************************************/
+	void sample(PerlinNoise* noise, std::vector<double>& values) const;
+};
+
+/***************************************************************************//**
+ * A saved state of a map, to roll back to or fork other maps from. Snapshots
+ * share their columns with the map rather than copying them, and a map copies
+ * a column into its own store the first time it changes it after a snapshot,
+ * so a snapshot costs the node array plus whatever is eroded afterwards.
+ ******************************************************************************/
+struct MapSnapshot
+{
+	int width;
+	int height;
+	bool tiled;
+	int age;
+	int growth;
+	unsigned int seed;
+	float maxHeight;
+	std::vector<Node> nodes;
+	std::vector<glm::vec2> springs;
+	// The frozen stores the nodes' columns are held in
+	std::vector<std::shared_ptr<ColumnStore>> columns;
+	// Builds the layers the nodes haven't built yet
+	std::shared_ptr<Subsurface> subsurface;
+};
+
 /***************************************************************************//**
  * The map class serves as the simulation access point- all calls to
  * simulate anything will go through here. It also houses all node
@@ -214,15 +364,124 @@ public:
 	 @param seed The seed to generate the map from 
 	 ******************************************************************************/
 	Map(int width, int height, MapParams params, unsigned int seed = 0);
+	/***************************************************************************//**
+	 * Forks a map from a snapshot, sharing its columns until they are changed.
+	 @param snapshot The snapshot to fork from
+	 @param params Defines for simulation within the map, which may differ from the original map's
+	 ******************************************************************************/
+	Map(const MapSnapshot& snapshot, MapParams params);
+	/***************************************************************************//**
+	 * Quickly generates a preview of a map, to show while the map itself is
+	 * generated. Only every previewSpacing'th node's surface is sampled, with
+	 * the rest interpolated between them, and there's nothing under the surface
+	 * but bedrock, nor any trees or springs.
+	 @param width The width of the map
+	 @param height The height of the map
+	 @param params Defines for generation and simulation within the map
+	 @param seed The seed to generate the map from
+	 @param previewSpacing The distance between sampled nodes
+	 ******************************************************************************/
+	Map(int width, int height, MapParams params, unsigned int seed, int previewSpacing);
 	~Map();
 
 	/***************************************************************************//**
-	 * Assumes a heightmap has been generated, and populates the area underneath
-	 * with soil data. Uses perlin noise for randomisation.
-	 @param resistivityNoise noise for terrain resistivity
-	 @param rockNoise noise for rock generation (at heigher values rocks will generate)
+	 * Saves the current state of the map. Cheap to take, as columns are shared
+	 * with the map until it changes them.
+	 @return The snapshot, to be rolled back to or forked from
+	 ******************************************************************************/
+	std::shared_ptr<const MapSnapshot> snapshot();
+	/***************************************************************************//**
+	 * Restores the map to a snapshot taken from it, or from a map of the same size.
+	 @param snapshot The snapshot to restore
+	 ******************************************************************************/
+	void rollback(const MapSnapshot& snapshot);
+
+	/***************************************************************************//**
+	 * Generates the map again with new parameters, keeping its size and seed.
+	 * Only the stages from the first one reading a changed parameter are run,
+	 * the rest keeping what they produced last time. Once the map has been
+	 * simulated, its columns, trees and springs are always generated again.
+	 @param params Defines for generation and simulation within the map
+	 ******************************************************************************/
+	void regenerate(MapParams params);
+
+	/***************************************************************************//**
+	 * Runs generation from a stage onwards.
+	 @param firstStage The first generationStage to run
+	 ******************************************************************************/
+	void generate(int firstStage);
+	/***************************************************************************//**
+	 * Fills an array with the noise generation is sampled from, seeded from the map's seed.
+	 @param noises The array to fill, indexed by noiseType
+	 ******************************************************************************/
+	void createNoises(PerlinNoise* noises);
+	/***************************************************************************//**
+	 * Samples the terrain noise for the height of every node's surface.
+	 @param noises The generated noise, indexed by noiseType
+	 ******************************************************************************/
+	void generateHeightfield(PerlinNoise* noises);
+	/***************************************************************************//**
+	 * Covers each surface with sand or topsoil, depending on its height.
+	 @param noises The generated noise, indexed by noiseType
+	 ******************************************************************************/
+	void generateSurface(PerlinNoise* noises);
+	/***************************************************************************//**
+	 * Builds every node's column from its surface marker, and populates the area
+	 * underneath with soil data. Uses perlin noise for randomisation. With
+	 * lazySubsurfaceDepth set, deeper layers are left for the nodes to build
+	 * when they're reached.
+	 @param noises The generated noise, indexed by noiseType
+	 ******************************************************************************/
+	void addRocksAndDirt(PerlinNoise* noises);
+	/***************************************************************************//**
+	 * Replaces every node with a column holding its surface marker and bedrock,
+	 * filled with water to sea level.
+	 ******************************************************************************/
+	void placeSurfaces();
+	void placeTrees();
+	void placeSprings();
+	/***************************************************************************//**
+	 * Samples the noise for the surface heights of a row of nodes, a batch of
+	 * nodes at a time. Safe to call from several threads at once.
+	 @param noises The generated noise, indexed by noiseType
+	 @param caches The low frequency noise, indexed by cachedNoise. Noise that wasn't cached is sampled directly.
+	 @param row The row, which is its X coordinate unless previewing
+	 @param heights Filled with the surface height of each node in the row
+	 @return The largest difference the caches made to a surface height, if validateNoiseCache is on
+	 ******************************************************************************/
+	float generateHeights(PerlinNoise* noises, const NoiseCache* caches, int row, float* heights);
+	/***************************************************************************//**
+	 * Samples the noise for the surface markers of a row of nodes. Safe to call
+	 * from several threads at once.
+	 @param noises The generated noise, indexed by noiseType
+	 @param row The row, which is its X coordinate unless previewing
+	 @param heights The surface height of each node in the row
+	 @param surfaces Filled with the surface marker of each node in the row
 	 ******************************************************************************/
-	void addRocksAndDirt(PerlinNoise* resistivityNoise, PerlinNoise* rockNoise);
+	void generateSurfaces(PerlinNoise* noises, int row, const float* heights, NodeMarker* surfaces);
+	/***************************************************************************//**
+	 * Hashes everything that decides the world a map generates, leaving out
+	 * parameters only read by the simulation.
+	 @param params Defines for generation and simulation within the map
+	 @param width The width of the map
+	 @param height The height of the map
+	 @param seed The seed the map is generated from
+	 ******************************************************************************/
+	static unsigned long long getWorldKey(const MapParams& params, int width, int height, unsigned int seed);
+	/***************************************************************************//**
+	 * Writes the generated world to a binary file, as it's laid out in memory.
+	 @param path The file to write
+	 @param key The world key of the map, from getWorldKey
+	 ******************************************************************************/
+	void saveWorld(const std::string& path, unsigned long long key) const;
+	/***************************************************************************//**
+	 * Reads a world written by saveWorld in place of generating it. The nodes
+	 * are left to be relinked to the map's stores once it has been read.
+	 @param path The file to read
+	 @param key The world key the file must have been written with
+	 @return Whether the world was read. The map is unchanged if it wasn't.
+	 ******************************************************************************/
+	bool loadWorld(const std::string& path, unsigned long long key);
 	/***************************************************************************//**
 	 * Calculates a perlin noise sample coordinate based on rarity of a feature,
 	 * scale, and the current position
@@ -236,14 +495,33 @@ public:
 	float getScale() { return m_params.scale; }
 	float getMaxHeight() { return m_maxHeight; }
 	int getAge() { return m_age; }
+	unsigned int getSeed() { return m_random.getSeed(); }
+	/***************************************************************************//**
+	 * Finds a node, clamping coordinates that fall outside of the map onto its edge.
+	 @param x The X coordinate of the node
+	 @param y The Y coordinate of the node
+	 ******************************************************************************/
 	Node* getNodeAt(int x, int y);
+	/***************************************************************************//**
+	 * Finds a node from its position in the halo grid, clamped onto the map. For
+	 * stencils that step between neighbours by offsetting a halo index.
+	 @param haloIndex The position of the node within the halo grid
+	 ******************************************************************************/
+	Node* getNodeAtHalo(int haloIndex) { return &m_nodes[HaloGrid::clamped(m_grid.entry(haloIndex))]; }
+	const HaloGrid& getGrid() { return m_grid; }
 	float getDensityAt(int x, int y, float height);
 	float getHeightAt(int x, int y);
 	float getHeightAt(int index);
 	float getDepthAt(int index);
-	float getHillValue(PerlinNoise* noise, int x, int y, float hillHeight, float rarity);
-	float getDivetValue(PerlinNoise* noise, int x, int y, float divetHeight, float rarity);
-	float getMountainValue(PerlinNoise* noise, int x, int y, float mountainHeight, float rarity);
+	/***************************************************************************//**
+	 * Turns noise sampled at a position from calculateXYFromRarity into the
+	 * height a feature adds there.
+	 @param noise The feature's noise
+	 @param varianceNoise The hill noise sampled at twice the height
+	 ******************************************************************************/
+	float getHillValue(double noise, double varianceNoise, float hillHeight);
+	float getDivetValue(double noise, float divetHeight);
+	float getMountainValue(double noise, float mountainHeight);
 	/***************************************************************************//**
 	 * Defines all commonly-seen soils for comparison to map data
 	 ******************************************************************************/
@@ -283,26 +561,81 @@ public:
 
 	// Hydrology Functions
 	void erode(int cycles);
+	/***************************************************************************//**
+	 * Runs drops in parallel on tiles of the map. Tiles take turns in four phases
+	 * of a checkerboard, so the tiles running at once are a tile apart, and drops
+	 * that step off a tile are handed to the next tile at the end of each phase.
+	 * Pools too big for a tile are formed after each round of phases, in the
+	 * order their drops were spawned. The result only depends on the seed and
+	 * tile size, not the number of threads.
+	 @param cycles The number of drops to run
+	 @param track Set for every node drops flow past
+	 ******************************************************************************/
+	void erodeOnTiles(int cycles, bool* track);
+	/***************************************************************************//**
+	 * Runs a drop until it finishes, steps off its tile, or starts a pool that
+	 * reaches outside the area of the tile's flood fill.
+	 @param drop The drop to run
+	 @param tile The corners of the tile, with the far corner just outside it
+	 @param fill The flood fill for the tile, whose area is as far as the drop's pools may spread
+	 @param track Set for every node the drop flows past
+	 @param maxHeight The maximum height of the map, as far as the tile has seen
+	 ******************************************************************************/
+	dropProgress runDropOnTile(Drop& drop, glm::ivec4 tile, FloodFill& fill, bool* track, float& maxHeight);
+	/***************************************************************************//**
+	 * Merges alike markers in every column changed since the last call, printing
+	 * the number of markers before and after.
+	 ******************************************************************************/
+	void coalesceTouched();
 	void grow();
 
 	glm::vec3 normal(int index)
 	{
-		glm::vec2 pos = glm::vec2(index % m_width, index / m_width);
-		float left = getNodeAt(pos.x + 1, pos.y)->waterHeight(getNodeAt(pos.x + 1, pos.y)->topHeight());
-		float right = getNodeAt(pos.x - 1, pos.y)->waterHeight(getNodeAt(pos.x - 1, pos.y)->topHeight());
-		float up = getNodeAt(pos.x, pos.y + 1)->waterHeight(getNodeAt(pos.x, pos.y + 1)->topHeight());
-		float down = getNodeAt(pos.x, pos.y - 1)->waterHeight(getNodeAt(pos.x, pos.y - 1)->topHeight());
+		const int center = m_grid.haloIndexOf(index);
+		const int stride = m_grid.getStride();
+		const Node* leftNode = getNodeAtHalo(center + 1);
+		const Node* rightNode = getNodeAtHalo(center - 1);
+		const Node* upNode = getNodeAtHalo(center + stride);
+		const Node* downNode = getNodeAtHalo(center - stride);
+		float left = leftNode->waterHeight(leftNode->topHeight());
+		float right = rightNode->waterHeight(rightNode->topHeight());
+		float up = upNode->waterHeight(upNode->topHeight());
+		float down = downNode->waterHeight(downNode->topHeight());
 		return glm::normalize(glm::vec3(2 * (right - left), 2 * (down - up), -4));
 	}
 	
 
 protected:
 	Node* m_nodes;
+	ColumnStore m_columns;
+	// Frozen stores holding columns shared with snapshots
+	std::vector<std::shared_ptr<ColumnStore>> m_sharedColumns;
+	HaloGrid m_grid;
 	int m_width;
 	int m_height;
 	int m_age;
+	// How many times the plants have grown, keying what they draw apart from erosion's age
+	int m_growth;
 	float m_maxHeight;
 	std::vector<glm::vec2> m_springs;
 	std::vector<SoilDefinition> m_soilDefinitions;
 	MapParams m_params;
+	// All randomness in generation and simulation is drawn from here, keyed by what it's drawn for
+	Random m_random;
+	std::unique_ptr<ThreadPool> m_threads;
+	// Finds the pools drops flood when run one after another, kept so its workspace isn't allocated for every flood
+	FloodFill m_floodFill;
+	// The depressions of the map as erosion started, found again every time it does
+	Depressions m_depressions;
+	// The lakes drops have settled in, kept until the next time erosion starts
+	Lakes m_lakes;
+	// Generates the rock and soil layers under the map, including those nodes left to build later
+	std::shared_ptr<Subsurface> m_subsurface;
+	// What the heightfield and surface stages produced, row by row, kept so they needn't be run again on regeneration
+	std::vector<float> m_surfaceHeights;
+	std::vector<NodeMarker> m_surfaceMarkers;
+	// Whether anything has changed the nodes since they were generated
+	bool m_changedSinceGeneration = false;
+	// The distance between the nodes generation samples noise for, only more than 1 for previews
+	int m_sampleSpacing = 1;
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "MapBuilder.h"
+
+MapBuilder::MapBuilder(int width, int height, MapParams params, unsigned int seed)
+{
+	// The preview and the map have to agree on the seed
+	if (seed == 0)
+		seed = time(NULL);
+
+	m_preview.reset(new Map(width, height, params, seed, PREVIEW_SPACING));
+	m_thread = std::thread([this, width, height, params, seed]()
+	{
+		m_map = new Map(width, height, params, seed);
+		m_finished = true;
+	});
+}
+
+MapBuilder::MapBuilder(Map* map, MapParams params)
+{
+	m_map = map;
+	m_preview.reset(new Map(map->getWidth(), map->getHeight(), params, map->getSeed(), PREVIEW_SPACING));
+	m_thread = std::thread([this, params]()
+	{
+		m_map->regenerate(params);
+		m_finished = true;
+	});
+}
+
+MapBuilder::~MapBuilder()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+	delete m_map;
+}
+
+Map* MapBuilder::takeMap()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+
+	Map* map = m_map;
+	m_map = nullptr;
+	return map;
+}
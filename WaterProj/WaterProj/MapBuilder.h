@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "Map.h"
+
+// Previews sample the surface of every this many nodes along each side of the map
+#define PREVIEW_SPACING 8
+
+/***************************************************************************//**
+ * Generates a map on a thread of its own, so the window can keep responding.
+ * A coarse preview of the map is made straight away, to be shown until the
+ * map itself is finished.
+ *
+ * Nothing may touch the map being built until isFinished() returns true.
+ ******************************************************************************/
+class MapBuilder
+{
+public:
+	/***************************************************************************//**
+	 * Starts generating a new map.
+	 @param width The width of the map
+	 @param height The height of the map
+	 @param params Defines for generation and simulation within the map
+	 @param seed The seed to generate the map from, or 0 for one based on the current time
+	 ******************************************************************************/
+	MapBuilder(int width, int height, MapParams params, unsigned int seed);
+	/***************************************************************************//**
+	 * Starts regenerating an existing map with new parameters.
+	 @param map The map to regenerate, which is handed back by takeMap
+	 @param params Defines for generation and simulation within the map
+	 ******************************************************************************/
+	MapBuilder(Map* map, MapParams params);
+	/***************************************************************************//**
+	 * Waits for the map to finish, deleting it if it was never taken.
+	 ******************************************************************************/
+	~MapBuilder();
+	MapBuilder(const MapBuilder&) = delete;
+	MapBuilder& operator=(const MapBuilder&) = delete;
+
+	/***************************************************************************//**
+	 * The preview of the map. Stays owned by the builder.
+	 ******************************************************************************/
+	Map* getPreview() { return m_preview.get(); }
+	bool isFinished() const { return m_finished; }
+	/***************************************************************************//**
+	 * Hands over the finished map, waiting for it if it isn't finished yet.
+	 @return The map, now owned by the caller
+	 ******************************************************************************/
+	Map* takeMap();
+
+protected:
+	std::unique_ptr<Map> m_preview;
+	Map* m_map = nullptr;
+	std::thread m_thread;
+	std::atomic<bool> m_finished{ false };
+};
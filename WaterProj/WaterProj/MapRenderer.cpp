@@ -230,6 +230,9 @@ void MapRenderer::render(SDL_Window* window)
 	prepareRender(false);
 	const int lodScale = lodScaling();
 	const float cullDist = getCullDist();
+	// Steps of up to HALO_WIDTH off the map land in the halo, so neighbours need no bounds checks
+	const HaloGrid& grid = m_map->getGrid();
+	const int rowStep = grid.getStride() * lodScale;
 
 	for (int x = 0; x < m_map->getWidth(); x += lodScale)
 	{
@@ -251,14 +254,15 @@ void MapRenderer::render(SDL_Window* window)
 			model = glm::scale(model, glm::vec3(lodScale, 1.0f, lodScale));
 
 			// Get surrounding nodes
-			const Node* right = m_map->getNodeAt(x + lodScale, y);
-			const Node* left = m_map->getNodeAt(x - lodScale, y);
-			const Node* down = m_map->getNodeAt(x, y + lodScale);
-			const Node* up = m_map->getNodeAt(x, y - lodScale);
-			const Node* rightUp = m_map->getNodeAt(x + lodScale, y - lodScale);
-			const Node* rightDown = m_map->getNodeAt(x + lodScale, y + lodScale);
-			const Node* leftUp = m_map->getNodeAt(x - lodScale, y - lodScale);
-			const Node* leftDown = m_map->getNodeAt(x - lodScale, y + lodScale);
+			const int center = grid.haloIndex(x, y);
+			const Node* right = m_map->getNodeAtHalo(center + lodScale);
+			const Node* left = m_map->getNodeAtHalo(center - lodScale);
+			const Node* down = m_map->getNodeAtHalo(center + rowStep);
+			const Node* up = m_map->getNodeAtHalo(center - rowStep);
+			const Node* rightUp = m_map->getNodeAtHalo(center + lodScale - rowStep);
+			const Node* rightDown = m_map->getNodeAtHalo(center + lodScale + rowStep);
+			const Node* leftUp = m_map->getNodeAtHalo(center - lodScale - rowStep);
+			const Node* leftDown = m_map->getNodeAtHalo(center - lodScale + rowStep);
 			
 			// Calculate average values for each edge on the tile
 			const float topRightHeight = ((up->topHeight() + right->topHeight() + rightUp->topHeight() + height) / 4.0f) - height;
@@ -284,7 +288,7 @@ void MapRenderer::render(SDL_Window* window)
 			glUniform3fv(m_surroundingColorLoc, 4, colors);
 
 			// Water height
-			float waterHeight = m_map->getNodeAt(x, y)->waterHeight(0.0f);
+			float waterHeight = m_map->getNodeAtHalo(center)->waterHeight(0.0f);
 			const float topRightWater = ((up->waterHeight(waterHeight) + right->waterHeight(waterHeight) + rightUp->waterHeight(waterHeight) + waterHeight) / 4.0f);
 			const float bottomRightWater = ((down->waterHeight(waterHeight) + right->waterHeight(waterHeight) + rightDown->waterHeight(waterHeight) + waterHeight) / 4.0f);
 			const float bottomLeftWater = ((down->waterHeight(waterHeight) + left->waterHeight(waterHeight) + leftDown->waterHeight(waterHeight) + waterHeight) / 4.0f);
@@ -308,6 +312,8 @@ void MapRenderer::renderAtHeight(SDL_Window* window, float height)
 	prepareRender(true);
 	const int lodScale = lodScaling();
 	const float cullDist = getCullDist();
+	const HaloGrid& grid = m_map->getGrid();
+	const int rowStep = grid.getStride() * lodScale;
 
 	for (int x = 0; x < m_map->getWidth(); x += lodScale)
 	{
@@ -323,17 +329,18 @@ void MapRenderer::renderAtHeight(SDL_Window* window, float height)
 			model = glm::scale(model, glm::vec3(lodScale, 1.0f, lodScale));
 
 			// Surrounding node data
-			const Node* right = m_map->getNodeAt(x + lodScale, y);
-			const Node* left = m_map->getNodeAt(x - lodScale, y);
-			const Node* down = m_map->getNodeAt(x, y + lodScale);
-			const Node* up = m_map->getNodeAt(x, y - lodScale);
-			const Node* rightUp = m_map->getNodeAt(x + lodScale, y - lodScale);
-			const Node* rightDown = m_map->getNodeAt(x + lodScale, y + lodScale);
-			const Node* leftUp = m_map->getNodeAt(x - lodScale, y - lodScale);
-			const Node* leftDown = m_map->getNodeAt(x - lodScale, y + lodScale); 
+			const int center = grid.haloIndex(x, y);
+			Node* right = m_map->getNodeAtHalo(center + lodScale);
+			Node* left = m_map->getNodeAtHalo(center - lodScale);
+			Node* down = m_map->getNodeAtHalo(center + rowStep);
+			Node* up = m_map->getNodeAtHalo(center - rowStep);
+			Node* rightUp = m_map->getNodeAtHalo(center + lodScale - rowStep);
+			Node* rightDown = m_map->getNodeAtHalo(center + lodScale + rowStep);
+			Node* leftUp = m_map->getNodeAtHalo(center - lodScale - rowStep);
+			Node* leftDown = m_map->getNodeAtHalo(center - lodScale + rowStep); 
 
 			// Color data at given height
-			const glm::vec3 color = m_map->getNodeAt(x, y)->getColorAtHeight(height);
+			const glm::vec3 color = m_map->getNodeAtHalo(center)->getColorAtHeight(height);
 			const glm::vec3 topRightColor = ((up->getColorAtHeight(height) + right->getColorAtHeight(height) + rightUp->getColorAtHeight(height) + color) / 4.0f);
 			const glm::vec3 bottomRightColor = ((down->getColorAtHeight(height) + right->getColorAtHeight(height) + rightDown->getColorAtHeight(height) + color) / 4.0f);
 			const glm::vec3 bottomLeftColor = ((down->getColorAtHeight(height) + left->getColorAtHeight(height) + leftDown->getColorAtHeight(height) + color) / 4.0f);
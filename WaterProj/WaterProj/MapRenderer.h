@@ -49,6 +49,11 @@ public:
 	void makeMapTile();
 	void transformCam(glm::vec2 transformation);
 	void setMap(Map* map);
+	/***************************************************************************//**
+	 * Renders another map of the same area from now on, leaving the camera where it is.
+	 @params map The map to render
+	 ******************************************************************************/
+	void swapMap(Map* map) { m_map = map; }
 	void setCamPos(glm::vec3 camPos) { m_camPos = camPos; }
 	glm::vec3 getCamPos() { return m_camPos; }
 	void zoomIn();
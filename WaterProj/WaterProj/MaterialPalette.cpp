@@ -0,0 +1,160 @@
+#include "MaterialPalette.h"
+
+#include <cfloat>
+
+#include "BinaryStream.h"
+#include "Node.h"
+
+// Bit positions and widths of each property within a material key
+#define KEY_RESIST_SHIFT 0
+#define KEY_RESIST_BITS 14
+#define KEY_HARD_STOP_SHIFT 14
+#define KEY_RED_SHIFT 15
+#define KEY_GREEN_SHIFT 20
+#define KEY_BLUE_SHIFT 26
+#define KEY_FERTILITY_SHIFT 31
+#define KEY_SAND_SHIFT 39
+#define KEY_CLAY_SHIFT 47
+
+static unsigned long long field(unsigned long long key, int shift, int bits)
+{
+	return (key >> shift) & ((1ull << bits) - 1);
+}
+
+static unsigned long long bin(float value, float max, float steps)
+{
+	return (unsigned long long)(glm::clamp(value, 0.0f, max) * steps + 0.5f);
+}
+
+unsigned long long MaterialPalette::key(const NodeMarker& marker)
+{
+	return (bin(marker.resistiveForce, 63.99f, 256.0f) << KEY_RESIST_SHIFT)
+		| ((unsigned long long)marker.hardStop << KEY_HARD_STOP_SHIFT)
+		| (bin(marker.color.r, 1.0f, 31.0f) << KEY_RED_SHIFT)
+		| (bin(marker.color.g, 1.0f, 63.0f) << KEY_GREEN_SHIFT)
+		| (bin(marker.color.b, 1.0f, 31.0f) << KEY_BLUE_SHIFT)
+		| (bin(marker.fertility, 1.0f, 255.0f) << KEY_FERTILITY_SHIFT)
+		| (bin(marker.sandAmount, 1.0f, 255.0f) << KEY_SAND_SHIFT)
+		| (bin(marker.clayAmount, 1.0f, 255.0f) << KEY_CLAY_SHIFT);
+}
+
+unsigned long long MaterialPalette::coarseKey(unsigned long long key)
+{
+	// 1/16 of resistive force, 3 bits a color channel and 4 bit fractions
+	return (field(key, KEY_RESIST_SHIFT, KEY_RESIST_BITS) >> 4)
+		| (field(key, KEY_HARD_STOP_SHIFT, 1) << 10)
+		| ((field(key, KEY_RED_SHIFT, 5) >> 2) << 11)
+		| ((field(key, KEY_GREEN_SHIFT, 6) >> 3) << 14)
+		| ((field(key, KEY_BLUE_SHIFT, 5) >> 2) << 17)
+		| ((field(key, KEY_FERTILITY_SHIFT, 8) >> 4) << 20)
+		| ((field(key, KEY_SAND_SHIFT, 8) >> 4) << 24)
+		| ((field(key, KEY_CLAY_SHIFT, 8) >> 4) << 28);
+}
+
+static Material materialFromKey(unsigned long long key)
+{
+	Material material;
+	material.resistiveForce = field(key, KEY_RESIST_SHIFT, KEY_RESIST_BITS) / 256.0f;
+	material.hardStop = field(key, KEY_HARD_STOP_SHIFT, 1) != 0;
+	material.color = glm::vec3(field(key, KEY_RED_SHIFT, 5) / 31.0f, field(key, KEY_GREEN_SHIFT, 6) / 63.0f, field(key, KEY_BLUE_SHIFT, 5) / 31.0f);
+	material.fertility = field(key, KEY_FERTILITY_SHIFT, 8) / 255.0f;
+	material.sandAmount = field(key, KEY_SAND_SHIFT, 8) / 255.0f;
+	material.clayAmount = field(key, KEY_CLAY_SHIFT, 8) / 255.0f;
+	return material;
+}
+
+unsigned short MaterialPalette::intern(const NodeMarker& marker)
+{
+	const unsigned long long materialKey = key(marker);
+	auto found = m_lookup.find(materialKey);
+	if (found != m_lookup.end())
+		return found->second;
+
+	if (m_materials.size() >= PALETTE_MAX_MATERIALS)
+		return closest(materialKey);
+
+	const unsigned short index = (unsigned short)m_materials.size();
+	m_materials.push_back(materialFromKey(materialKey));
+	m_lookup.emplace(materialKey, index);
+	m_coarseLookup.emplace(coarseKey(materialKey), index);
+	return index;
+}
+
+unsigned short MaterialPalette::closest(unsigned long long materialKey) const
+{
+	auto found = m_coarseLookup.find(coarseKey(materialKey));
+	if (found != m_coarseLookup.end())
+		return found->second;
+
+	const Material material = materialFromKey(materialKey);
+
+	// Nothing similar has been seen at all, which is rare enough to search the whole palette for
+	unsigned short best = 0;
+	float bestDistance = FLT_MAX;
+	for (int i = 0; i < (int)m_materials.size(); ++i)
+	{
+		const Material& other = m_materials[i];
+		float distance = glm::abs(other.resistiveForce - material.resistiveForce) / 4.0f + glm::length(other.color - material.color)
+			+ glm::abs(other.fertility - material.fertility) + glm::abs(other.sandAmount - material.sandAmount) + glm::abs(other.clayAmount - material.clayAmount);
+		if (other.hardStop != material.hardStop)
+			distance += 10.0f;
+
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			best = (unsigned short)i;
+		}
+	}
+
+	return best;
+}
+
+NodeMarker MaterialPalette::quantize(const NodeMarker& marker)
+{
+	const Material material = materialFromKey(key(marker));
+	return NodeMarker(marker.height, material.resistiveForce, material.hardStop, material.color, material.fertility, material.sandAmount, material.clayAmount);
+}
+
+bool MaterialPalette::findSoilType(const NodeMarker& marker, int& soilType, float& certainty) const
+{
+	auto found = m_soilTypes.find(key(marker));
+	if (found == m_soilTypes.end())
+		return false;
+
+	soilType = found->second.first;
+	certainty = found->second.second;
+	return true;
+}
+
+void MaterialPalette::cacheSoilType(const NodeMarker& marker, int soilType, float certainty)
+{
+	m_soilTypes.emplace(key(marker), std::pair<int, float>(soilType, certainty));
+}
+
+void MaterialPalette::save(std::ostream& stream) const
+{
+	// Materials are rebuilt from their keys, which hold everything about them
+	std::vector<unsigned long long> keys(m_materials.size());
+	for (const auto& entry : m_lookup)
+		keys[entry.second] = entry.first;
+	writeVector(stream, keys);
+}
+
+bool MaterialPalette::load(std::istream& stream)
+{
+	std::vector<unsigned long long> keys;
+	if (!readVector(stream, keys) || keys.size() > PALETTE_MAX_MATERIALS)
+		return false;
+
+	m_materials.clear();
+	m_lookup.clear();
+	m_coarseLookup.clear();
+	m_soilTypes.clear();
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		m_materials.push_back(materialFromKey(keys[i]));
+		m_lookup.emplace(keys[i], (unsigned short)i);
+		m_coarseLookup.emplace(coarseKey(keys[i]), (unsigned short)i);
+	}
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glm.hpp>
+#include <iosfwd>
+#include <unordered_map>
+#include <vector>
+
+struct NodeMarker;
+
+// Markers refer to materials by a 16 bit index
+#define PALETTE_MAX_MATERIALS 65536
+// The most a full palette puts a new marker's properties out by, as long as its coarse bin has a material
+#define PALETTE_FULL_RESIST_ERROR 0.061f
+#define PALETTE_FULL_FRACTION_ERROR 0.061f
+#define PALETTE_FULL_COLOR_ERROR 0.12f
+
+/***************************************************************************//**
+ * The soil properties of a marker, shared between every marker made of it.
+ ******************************************************************************/
+struct Material
+{
+	float resistiveForce;
+	bool hardStop;
+	float fertility;
+	float sandAmount;
+	float clayAmount;
+	glm::vec3 color;
+};
+
+/***************************************************************************//**
+ * An interned table of materials. Marker properties are quantized into bins,
+ * and every marker falling into the same bins shares one material holding the
+ * bin values, so the results don't depend on the order markers were added in.
+ *
+ * Bins are 1/256 of resistive force up to 64, RGB565 color, and 8 bit
+ * fertility, sand and clay fractions. Once the palette is full, new markers
+ * use the first material added to their bin in a coarser set instead: 1/16
+ * of resistive force, 3 bits a color channel and 4 bit fractions. That puts
+ * them out by up to 0.061 in resistive force, fertility, sand and clay, and
+ * 0.12 in color. A marker whose coarse bin has no material takes whichever
+ * material is nearest, which can be out by any amount.
+ ******************************************************************************/
+class MaterialPalette
+{
+public:
+	/***************************************************************************//**
+	 * Finds the material for a marker's properties, adding it if there's room.
+	 @param marker The marker to find a material for. Its height is ignored.
+	 @return The index of the material
+	 ******************************************************************************/
+	unsigned short intern(const NodeMarker& marker);
+	const Material& get(unsigned short index) const { return m_materials[index]; }
+	int getSize() const { return (int)m_materials.size(); }
+	/***************************************************************************//**
+	 * Quantizes a marker's properties to the values its material would hold.
+	 @param marker The marker to quantize
+	 ******************************************************************************/
+	static NodeMarker quantize(const NodeMarker& marker);
+	/***************************************************************************//**
+	 * Looks up a cached soil classification for a marker's material bin.
+	 @param marker The marker to look up
+	 @param soilType Set to the index of the soil type, if cached
+	 @param certainty Set to the certainty of the soil type, if cached
+	 @return Whether a classification was cached
+	 ******************************************************************************/
+	bool findSoilType(const NodeMarker& marker, int& soilType, float& certainty) const;
+	void cacheSoilType(const NodeMarker& marker, int soilType, float certainty);
+	/***************************************************************************//**
+	 * Writes the materials to a binary stream, in index order.
+	 @param stream The stream to write to
+	 ******************************************************************************/
+	void save(std::ostream& stream) const;
+	/***************************************************************************//**
+	 * Replaces the materials with ones written by save, keeping their indices.
+	 @param stream The stream to read from
+	 @return Whether the materials were read
+	 ******************************************************************************/
+	bool load(std::istream& stream);
+
+protected:
+	static unsigned long long key(const NodeMarker& marker);
+	static unsigned long long coarseKey(unsigned long long key);
+	unsigned short closest(unsigned long long materialKey) const;
+
+	std::vector<Material> m_materials;
+	std::unordered_map<unsigned long long, unsigned short> m_lookup;
+	// The first material added in each coarse bin, for when the palette is full
+	std::unordered_map<unsigned long long, unsigned short> m_coarseLookup;
+	std::unordered_map<unsigned long long, std::pair<int, float>> m_soilTypes;
+};
@@ -1,13 +1,154 @@
 #include "Node.h"
 
+#include <algorithm>
 #include <ext.hpp>
 #include <iostream>
 
 #include "Plant.h"
+#include "Subsurface.h"
 
-NodeMarker* Node::top()
+// Slices spanning up to this many whole layers are mixed directly rather than from the column totals
+#define DIRECT_MIX_LAYERS 4
+
+void Node::attach(ColumnStore* store, int capacity)
+{
+	m_store = store;
+	m_owner = store;
+	m_offset = store->allocate(capacity);
+	m_capacity = capacity;
+	m_count = 0;
+}
+
+void Node::relink(ColumnStore* store)
+{
+	m_store = store;
+	m_owner = store;
+}
+
+void Node::makeWritable()
+{
+	ColumnStore* writable = ColumnStore::getRedirect();
+	if (!writable)
+		writable = m_owner;
+	if (m_store == writable)
+		return;
+
+	const ColumnStore* shared = m_store;
+	const int capacity = m_count + COLUMN_HEADROOM;
+	const int offset = writable->allocate(capacity);
+	for (int i = 0; i < m_count; ++i)
+	{
+		writable->set(offset + i, shared->get(m_offset + i));
+	}
+
+	// Other threads may be using the owner, so the slot left in it is only released when the column is returned
+	if (writable != m_owner)
+		writable->m_borrowed.push_back(std::make_pair(this, m_store == m_owner ? m_capacity : 0));
+
+	m_store = writable;
+	m_offset = offset;
+	m_capacity = capacity;
+	indexColumn(0);
+}
+
+NodeMarker Node::top() const
+{
+	return marker(m_count - 1);
+}
+
+void Node::reserve(int count)
+{
+	makeWritable();
+	if (count <= m_capacity)
+		return;
+
+	// Grow geometrically so a column being built up doesn't move on every marker
+	int capacity = glm::max(count, m_capacity * 2);
+	int offset = m_store->allocate(capacity);
+	m_store->move(m_offset, offset, m_count);
+	m_store->release(m_capacity);
+	m_offset = offset;
+	m_capacity = capacity;
+	indexColumn(0);
+}
+
+void Node::insertMarker(int index, const NodeMarker& marker)
+{
+	reserve(m_count + 1);
+	m_store->move(m_offset + index, m_offset + index + 1, m_count - index);
+	m_store->set(m_offset + index, marker);
+	m_count++;
+	indexColumn(index);
+}
+
+void Node::eraseMarker(int index)
 {
-	return &m_nodeData[0];
+	makeWritable();
+	m_store->move(m_offset + index + 1, m_offset + index, m_count - index - 1);
+	m_count--;
+	indexColumn(index);
+}
+
+void Node::indexColumn(int from)
+{
+	const float* heights = &m_store->heights[m_offset];
+	RockCount* rockCounts = &m_store->rockCounts[m_offset];
+	RockCount rockCount = from > 0 ? rockCounts[from - 1] : 0;
+
+	for (int i = from; i < m_count; ++i)
+	{
+		rockCount += m_store->isHardStop(m_offset + i);
+		rockCounts[i] = rockCount;
+	}
+
+	// Totals are stored at every SOIL_SUM_STRIDE'th marker of the store. The one at the marker below may be
+	// rewritten, but it can't have changed, so it's safe to start from.
+	int i = glm::max(from - 1, 0);
+	SoilSum sum = i > 0 ? soilBelow(i) : SoilSum();
+	for (; i < m_count; ++i)
+	{
+		if ((m_offset + i) % SOIL_SUM_STRIDE == 0)
+			m_store->soilSums[(m_offset + i) / SOIL_SUM_STRIDE] = sum;
+
+		// The layer above this marker runs up to the next one
+		if (i + 1 < m_count && !m_store->isHardStop(m_offset + i))
+			addLayer(sum, i, heights[i + 1] - heights[i]);
+	}
+}
+
+SoilSum Node::soilBelow(int index) const
+{
+	const float* heights = &m_store->heights[m_offset];
+	SoilSum sum;
+	int i = 0;
+
+	// Start from the nearest total at or below the marker, if it lies within the column
+	const int stored = (m_offset + index) / SOIL_SUM_STRIDE;
+	if (stored * SOIL_SUM_STRIDE >= m_offset)
+	{
+		sum = m_store->soilSums[stored];
+		i = stored * SOIL_SUM_STRIDE - m_offset;
+	}
+
+	for (; i < index; ++i)
+	{
+		if (!m_store->isHardStop(m_offset + i))
+			addLayer(sum, i, heights[i + 1] - heights[i]);
+	}
+
+	return sum;
+}
+
+void Node::addLayer(SoilSum& sum, int index, float amount) const
+{
+	const int i = m_offset + index;
+	sum.thickness += amount;
+	sum.height += m_store->heights[i] * amount;
+	sum.resistiveForce += m_store->getResistiveForce(i) * amount;
+	sum.fertility += m_store->getFertility(i) * amount;
+	sum.sandAmount += m_store->getSandAmount(i) * amount;
+	sum.clayAmount += m_store->getClayAmount(i) * amount;
+	sum.color += m_store->getColor(i) * amount;
 }
 
 void Node::addMarker(NodeMarker marker, float& maxHeight)
@@ -22,7 +163,7 @@ void Node::addMarker(float height, float resistiveForce, bool hardStop, glm::vec
 		maxHeight = height;
 	}
 
-	if (m_nodeData.size() > 0 && height > topHeight())
+	if (m_count > 0 && height > topHeight())
 	{
 		float diff = height - topHeight();
 		m_waterData.height = glm::max(m_waterData.height - diff, 0.0f);
@@ -30,174 +171,302 @@ void Node::addMarker(float height, float resistiveForce, bool hardStop, glm::vec
 			m_waterData.height = 0.0f;
 	}
 
-	// If there's no node data yet or this is the new lowest point, just push it back immediately.
-	if (m_nodeData.size() == 0 || m_nodeData[m_nodeData.size() - 1].height >= height)
+	NodeMarker marker(height, resistiveForce, hardStop, color, fertility, sandAmount, clayAmount);
+
+	// If there's no node data yet or this is the new lowest point, put it at the bottom immediately.
+	if (m_count == 0 || markerHeight(0) >= height)
 	{
-		NodeMarker marker;
-		marker.height = height;
-		marker.resistiveForce = resistiveForce;
-		marker.hardStop = hardStop;
-		marker.fertility = fertility;
-		marker.color = color;
-		marker.sandAmount = sandAmount;
-		marker.clayAmount = clayAmount;
-
-		m_nodeData.push_back(marker);
+		insertMarker(0, marker);
+		return;
+	}
+
+	// Deposits land on the surface, which is the end of the column, so they don't shift anything
+	if (height >= topHeight())
+	{
+		insertMarker(m_count, marker);
 		return;
 	}
 
 	// Else, put it in the right position
-	for (int i = 0; i < m_nodeData.size(); ++i)
+	for (int i = m_count - 1; i >= 0; --i)
 	{
-		if (height < m_nodeData[i].height)
+		if (height < markerHeight(i))
 			continue;
 
-		NodeMarker marker;
-		marker.height = height;
-		marker.resistiveForce = resistiveForce;
-		marker.hardStop = hardStop;
-		marker.fertility = fertility;
-		marker.color = color;
-		marker.sandAmount = sandAmount;
-		marker.clayAmount = clayAmount;
-
-		m_nodeData.insert(m_nodeData.begin() + i, marker);
+		insertMarker(i + 1, marker);
 		return;
 	}
 }
 
-float Node::getResistiveForceAtHeight(float height) const
+void Node::addMarkers(const NodeMarker* markers, int count, float& maxHeight)
 {
-	if (m_nodeData.size() == 0)
-		return 0;
-
-	float prevResist = 0.0f;
-	float prevHeight = 0.0f;
-	float rockResist = 0.0f;
-	bool isRock = false;
+	if (count <= 0)
+		return;
 
-	for (int i = 0; i < m_nodeData.size(); ++i)
+	// Follow the surface up through the run, as water is pushed out by each marker that lands above it
+	float top = m_count > 0 ? topHeight() : markers[0].height;
+	for (int i = 0; i < count; ++i)
 	{
-		if (height < m_nodeData[i].height)
+		const float height = markers[i].height;
+		if (height > maxHeight)
+			maxHeight = height;
+
+		if (m_count + i > 0 && height > top)
 		{
-			if (!m_nodeData[i].hardStop) 
-			{
-				prevResist = m_nodeData[i].resistiveForce;
-				prevHeight = m_nodeData[i].height;
-			}
-			else
-			{
-				if(!isRock)
-					rockResist = m_nodeData[i].resistiveForce;
-				isRock = !isRock;
-			}
-			continue;
+			m_waterData.height = glm::max(m_waterData.height - (height - top), 0.0f);
+			if (m_waterData.height < 0.05f)
+				m_waterData.height = 0.0f;
 		}
+		top = glm::max(top, height);
+	}
+
+	// addMarker puts markers at or below the bottom of the column beneath it, so those at the start of the run end
+	// up at the bottom, reversed. As the run is sorted, only the first and any level with it can.
+	int below = 0;
+	if (m_count == 0 || markers[0].height <= markerHeight(0))
+	{
+		below = 1;
+		while (below < count && markers[below].height == markers[0].height)
+			++below;
+	}
 
-		if (isRock)
-			return rockResist;
+	reserve(m_count + count);
 
-		float currHeight = m_nodeData[i].height;
-		float currDens = m_nodeData[i].resistiveForce;
-		float downScaledDist = (height - currHeight) / (prevHeight - currHeight);
-		return (currDens + downScaledDist * (prevResist - currDens));
+	// Merge the rest of the run in from the top down, with markers level with the column going above it
+	int write = m_count + count - 1;
+	int column = m_count - 1;
+	for (int run = count - 1; run >= below; --write)
+	{
+		if (column >= 0 && markerHeight(column) > markers[run].height)
+			m_store->move(m_offset + column--, m_offset + write, 1);
+		else
+			m_store->set(m_offset + write, markers[run--]);
 	}
 
-	return m_nodeData[m_nodeData.size() - 1].resistiveForce;
+	// Whatever is left of the column only has to make room for the markers below it
+	m_store->move(m_offset, m_offset + below, column + 1);
+	for (int i = 0; i < below; ++i)
+		m_store->set(m_offset + i, markers[below - 1 - i]);
+
+	m_count += count;
+	indexColumn(0);
 }
 
-glm::vec3 Node::getColorAtHeight(float height) const
+void Node::deferLayers(int count)
 {
-	if (m_nodeData.size() == 0)
-		return glm::vec3(0.0f, 0.0f, 0.0f);
+	m_deferredLayers = count;
+}
 
-	glm::vec3 prevColor(0.0f);
-	float prevHeight = 0.0f;
-	glm::vec3 rockColor(0.0f);
-	bool isRock = false;
+void Node::ensureBuiltBelow(float height)
+{
+	// The column is whole from its lowest built marker up, with only bedrock below it
+	if (m_deferredLayers > 0 && height < markerHeight(1))
+		buildDeferredLayers();
+}
 
-	for (int i = 0; i < m_nodeData.size(); ++i)
+void Node::buildDeferredLayers()
+{
+	std::vector<NodeMarker> layers;
+	std::vector<int> starts;
+	const glm::ivec2 range(0, m_deferredLayers);
+	const glm::ivec2 position = m_owner->getPosition(this);
+	m_owner->getSubsurface()->generate(position.x, position.y, 1, &range, layers, starts);
+	m_deferredLayers = 0;
+
+	// The layers are all below the surface, so can't raise the map's max height
+	float maxHeight = topHeight();
+	addMarkers(layers.data(), (int)layers.size(), maxHeight);
+}
+
+void Node::sampleAtHeight(float height, glm::vec3& color, float& resistiveForce) const
+{
+	const float* heights = &m_store->heights[m_offset];
+	const RockCount* rockCounts = &m_store->rockCounts[m_offset];
+
+	// Markers are sorted, so everything above the height is a run at the end of the column
+	const int above = (int)(std::upper_bound(heights, heights + m_count, height) - heights);
+
+	// Below the whole column
+	if (above == 0)
 	{
-		if (height < m_nodeData[i].height)
-		{
-			if (!m_nodeData[i].hardStop)
-			{
-				prevColor = m_nodeData[i].color;
-				prevHeight = m_nodeData[i].height;
-			}
-			else
-			{
-				if (!isRock)
-					rockColor = m_nodeData[i].color;
-				isRock = !isRock;
-			}
-			continue;
-		}
+		resistiveForce = m_store->getResistiveForce(m_offset + 0);
+		color = m_store->getColor(m_offset + m_count - 1);
+		return;
+	}
+
+	// Rocks are bounded by pairs of hard stops, so an odd number of them above the height means we're inside one
+	const int rocksBelow = rockCounts[above - 1];
+	if ((rockCounts[m_count - 1] - rocksBelow) % 2 == 1)
+	{
+		// The rock we're in was opened by the lowest hard stop above the height
+		const int rock = (int)(std::upper_bound(rockCounts + above, rockCounts + m_count, rocksBelow) - rockCounts);
+		color = m_store->getColor(m_offset + rock);
+		resistiveForce = m_store->getResistiveForce(m_offset + rock);
+		return;
+	}
 
-		if (isRock)
-			return rockColor;
+	// Find the lowest soil marker above the height by searching the number of soil markers at or below each marker
+	const int soilMarkersBelow = above - rocksBelow;
+	int low = above;
+	int high = m_count;
+	while (low < high)
+	{
+		int mid = (low + high) / 2;
+		if (mid + 1 - rockCounts[mid] > soilMarkersBelow)
+			high = mid;
+		else
+			low = mid + 1;
+	}
 
-		float currHeight = m_nodeData[i].height;
-		glm::vec3 currCol = m_nodeData[i].color;
-		float downScaledDist = (height - currHeight) / (prevHeight - currHeight);
-		return (currCol + downScaledDist * (prevColor - currCol));
+	float prevResist = 0.0f;
+	glm::vec3 prevColor(0.0f);
+	float prevHeight = 0.0f;
+	if (low < m_count)
+	{
+		prevResist = m_store->getResistiveForce(m_offset + low);
+		prevColor = m_store->getColor(m_offset + low);
+		prevHeight = heights[low];
 	}
 
-	return m_nodeData[0].color;
+	const int i = above - 1;
+	float currHeight = heights[i];
+	float currDens = m_store->getResistiveForce(m_offset + i);
+	glm::vec3 currCol = m_store->getColor(m_offset + i);
+	float downScaledDist = (height - currHeight) / (prevHeight - currHeight);
+	resistiveForce = (currDens + downScaledDist * (prevResist - currDens));
+	color = (currCol + downScaledDist * (prevColor - currCol));
+}
+
+float Node::getResistiveForceAtHeight(float height)
+{
+	if (m_count == 0)
+		return 0;
+
+	ensureBuiltBelow(height);
+	glm::vec3 color;
+	float resistiveForce;
+	sampleAtHeight(height, color, resistiveForce);
+	return resistiveForce;
+}
+
+glm::vec3 Node::getColorAtHeight(float height)
+{
+	if (m_count == 0)
+		return glm::vec3(0.0f, 0.0f, 0.0f);
+
+	ensureBuiltBelow(height);
+	glm::vec3 color;
+	float resistiveForce;
+	sampleAtHeight(height, color, resistiveForce);
+	return color;
 }
 
 // Debug function. Removes top node data.
 void Node::skim()
 {
-	if(m_nodeData.size() > 1)
-		m_nodeData.erase(m_nodeData.begin());
+	if (m_count == 2 && m_deferredLayers > 0)
+		buildDeferredLayers();
+
+	if(m_count > 1)
+		eraseMarker(m_count - 1);
 }
 
 void Node::erodeByValue(float amount)
 {
-	const float base = m_nodeData[0].height;
-	const float newVal = base - amount;
+	m_touched = true;
+	const float newVal = topHeight() - amount;
 
-	for (int i = m_nodeData.size() - 1; i >= 0; --i)
-	{
-		if (m_nodeData[i].height < newVal)
-			continue;
+	if (topHeight() < newVal)
+		return;
+
+	ensureBuiltBelow(newVal);
+	makeWritable();
+	const int top = m_count - 1;
 
-		if (i == 0)
+	// Find the lowest marker still at or above the cut. Erosion only cuts into the top few markers, so walk down from the surface.
+	int i = top;
+	while (i > 0 && markerHeight(i - 1) >= newVal)
+		--i;
+
+	const int index = m_offset + i;
+	glm::vec3 color;
+	float resistiveForce;
+	sampleAtHeight(newVal, color, resistiveForce);
+	m_store->setColorAndResistiveForce(index, color, resistiveForce);
+	m_store->heights[index] = newVal;
+
+	if (i != top)
+		eraseMarker(i + 1);
+
+	indexColumn(i);
+}
+
+int Node::coalesce(float tolerance)
+{
+	m_touched = false;
+	makeWritable();
+	const int top = m_count - 1;
+	int kept = 0;
+	int firstChanged = m_count;
+	NodeMarker keptMarker = marker(0);
+
+	// Walk up the column, folding each marker into the last one kept while they're alike. The surface stays as it is.
+	for (int i = 1; i < top; ++i)
+	{
+		NodeMarker current = marker(i);
+		if (!keptMarker.hardStop && !current.hardStop && keptMarker.difference(current) < tolerance)
 		{
-			m_nodeData[i].color = getColorAtHeight(newVal);
-			m_nodeData[i].resistiveForce = getResistiveForceAtHeight(newVal);
-			m_nodeData[i].height = newVal;
-			return;
+			// The kept marker's layer currently reaches up to this one, and will now reach the next
+			float keptThickness = markerHeight(i) - keptMarker.height;
+			float thickness = markerHeight(i + 1) - markerHeight(i);
+			if (keptThickness + thickness > 0.0f)
+			{
+				float height = keptMarker.height;
+				keptMarker.mix(current, thickness / (keptThickness + thickness));
+				keptMarker.height = height;
+				m_store->set(m_offset + kept, keptMarker);
+			}
+			firstChanged = glm::min(firstChanged, kept);
+			continue;
 		}
 
-		if (m_nodeData[i].height >= newVal)
+		kept++;
+		keptMarker = current;
+		if (kept != i)
 		{
-			m_nodeData[i].color = getColorAtHeight(newVal);
-			m_nodeData[i].resistiveForce = getResistiveForceAtHeight(newVal);
-			m_nodeData[i].height = newVal;
-			m_nodeData.erase(m_nodeData.begin() + (i - 1));
-			return;
+			m_store->set(m_offset + kept, current);
+			firstChanged = glm::min(firstChanged, kept);
 		}
 	}
+
+	if (firstChanged == m_count)
+		return 0;
+
+	kept++;
+	m_store->move(m_offset + top, m_offset + kept, 1);
+	const int removed = m_count - (kept + 1);
+	m_count = kept + 1;
+	indexColumn(firstChanged);
+	return removed;
 }
 
 float Node::topHeight() const
 {
-	return m_nodeData[0].height;
+	return markerHeight(m_count - 1);
 }
 
 glm::vec3 Node::topColor() const
 {
 	float particles = glm::max(0.0f, glm::min(50.0f, glm::max(0.0f, getParticles()))) / 50.0f;
+	const glm::vec3 color = m_store->getColor(m_offset + m_count - 1);
 
 	if(particles > 0.01f && m_waterData.height < 0.25f)
-		return m_nodeData[0].color * glm::max(0.0f, 1.0f - particles) + glm::vec3(0.0f, 0.5f, 1.0f) * glm::min(1.0f, particles);
+		return color * glm::max(0.0f, 1.0f - particles) + glm::vec3(0.0f, 0.5f, 1.0f) * glm::min(1.0f, particles);
 
 	if (getFoliageDensity() == 0.0f)
-		return m_nodeData[0].color;
+		return color;
 	else
-		return m_nodeData[0].color * (1.0f - getFoliageDensity()) + glm::vec3(0.1f, 0.7f, 0.0f) * getFoliageDensity();
+		return color * (1.0f - getFoliageDensity()) + glm::vec3(0.1f, 0.7f, 0.0f) * getFoliageDensity();
 }
 
 void Node::addWater(float height)
@@ -235,10 +504,10 @@ float Node::waterHeight(float valIfNoWater) const
 
 float Node::waterHeightWithStreams(float valIfNoWater) const
 {
-	if (!hasWater() && m_waterData.particles == 0)
+	if (!hasWater() && m_waterData.getParticles() == 0)
 		return valIfNoWater;
 
-	return topHeight() + m_waterData.height + glm::min(1.0f, m_waterData.particles);
+	return topHeight() + m_waterData.height + glm::min(1.0f, m_waterData.getParticles());
 }
 
 void Node::setWaterDepth(float waterDepth)
@@ -258,6 +527,7 @@ bool Node::hasWater() const
 
 void Node::setHeight(float height, NodeMarker fillerData, float& maxHeight)
 {
+	m_touched = true;
 	NodeMarker copy = fillerData;
 	copy.height = height;
 
@@ -271,46 +541,62 @@ void Node::setHeight(float height, NodeMarker fillerData, float& maxHeight)
 	}
 }
 
-NodeMarker Node::getDataAboveHeight(float height, bool ignoreRock) const
+NodeMarker Node::getDataAboveHeight(float height, bool ignoreRock)
 {
-	NodeMarker marker = m_nodeData[0];
-	marker.fertility = Plant::getFertilityForNode(this);
-	float currentAmount = 0.0f;
-
-	for (int i = 1; i < m_nodeData.size(); i++)
+	ensureBuiltBelow(height);
+	const float* heights = &m_store->heights[m_offset];
+	const RockCount* rockCounts = &m_store->rockCounts[m_offset];
+	const int top = m_count - 1;
+
+	// Each marker is mixed in by the thickness of the layer above it. Layers owned by markers above
+	// the height are mixed in whole, and the layer owned by the marker below it is cut at the height.
+	const int above = (int)(std::upper_bound(heights, heights + m_count, height) - heights);
+	SoilSum sum;
+	if (above <= top)
 	{
-		if (height < m_nodeData[i - 1].height && height < m_nodeData[i].height)
+		if (top - above <= DIRECT_MIX_LAYERS)
 		{
-			if (!ignoreRock || !m_nodeData[i].hardStop)
+			// A thin slice off the top is summed directly, as the difference of two large totals would lose its precision
+			for (int i = above; i < top; ++i)
 			{
-				float amount = abs(m_nodeData[i - 1].height - m_nodeData[i].height);
-				currentAmount += amount;
-				if (currentAmount == 0.0f)
-					continue;
-				marker.mix(m_nodeData[i], amount / currentAmount);
+				if (!ignoreRock || !m_store->isHardStop(m_offset + i))
+					addLayer(sum, i, heights[i + 1] - heights[i]);
 			}
 		}
-		else if (height < m_nodeData[i - 1].height)
+		else
 		{
-			if (!ignoreRock || !m_nodeData[i].hardStop)
+			sum = soilBelow(top) - soilBelow(above);
+
+			// Rock layers aren't part of the soil totals, but there are only ever a few of them to add
+			if (!ignoreRock)
 			{
-				float amount = m_nodeData[i - 1].height - height;
-				currentAmount += amount;
-				if (currentAmount == 0.0f)
-					continue;
-				marker.mix(m_nodeData[i], amount / currentAmount);
+				int rocksSeen = above > 0 ? rockCounts[above - 1] : 0;
+				while (rocksSeen < rockCounts[top - 1])
+				{
+					const int rock = (int)(std::upper_bound(rockCounts + above, rockCounts + top, rocksSeen) - rockCounts);
+					addLayer(sum, rock, heights[rock + 1] - heights[rock]);
+					rocksSeen = rockCounts[rock];
+				}
 			}
 		}
-		else
-			break;
+
+		if (above > 0 && (!ignoreRock || !m_store->isHardStop(m_offset + above - 1)))
+			addLayer(sum, above - 1, heights[above] - height);
+	}
+
+	if (sum.thickness == 0.0f)
+	{
+		NodeMarker marker = this->marker(top);
+		marker.fertility = Plant::getFertilityForNode(this);
+		return marker;
 	}
 
-	return marker;
+	return NodeMarker(sum.height / sum.thickness, sum.resistiveForce / sum.thickness, false, sum.color / sum.thickness, sum.fertility / sum.thickness, sum.sandAmount / sum.thickness, sum.clayAmount / sum.thickness);
 }
 
 float Node::getParticles() const
 {
-	return m_waterData.particles;
+	return m_waterData.getParticles();
 }
 
 void Node::setParticles(float particles)
@@ -318,33 +604,33 @@ void Node::setParticles(float particles)
 	if (particles < 2.0f && particles > 0.0f && !hasWater())
 	{
 		// Calculate water supply to current node
-		m_vegetationData.waterSupply = 1.0f - (abs(1.0f - particles));
+		m_vegetationData.setWaterSupply(1.0f - (abs(1.0f - particles)));
 	}
 	else
 	{
-		m_vegetationData.waterSupply = 0.0f;
+		m_vegetationData.setWaterSupply(0.0f);
 	}
 
-	m_waterData.particles = particles;
+	m_waterData.setParticles(particles);
 }
 
 float Node::getFoliageDensity() const
 {
-	return glm::min(1.0f, m_vegetationData.density);
+	return glm::min(1.0f, m_vegetationData.getDensity());
 }
 
 float Node::getFoliageWaterSupply() const
 {
-	return m_vegetationData.waterSupply;
+	return m_vegetationData.getWaterSupply();
 }
 
 void Node::setFoliageDensity(float foliageDensity)
 {
 	float modifDensity = glm::min(1.0f, glm::max(foliageDensity, 0.0f));
-	m_vegetationData.density = modifDensity;
+	m_vegetationData.setDensity(modifDensity);
 }
 
 float Node::getFertility() const
 {
-	return m_nodeData[0].fertility;
+	return m_store->getFertility(m_offset + m_count - 1);
 }
\ No newline at end of file
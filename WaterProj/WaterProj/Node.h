@@ -2,16 +2,30 @@
 
 #include <GL/glew.h>
 #include <glm.hpp>
+#include <gtc/packing.hpp>
 #include <string>
 #include <vector>
 
+#include "ColumnStore.h"
+
 /***************************************************************************//**
  * Data attaining to the amount of water on a node
  ******************************************************************************/
 struct WaterData
 {
 	float height;
+#ifdef COMPACT_MARKERS
+	// Half float, accurate to about 0.05%
+	unsigned short particles;
+
+	float getParticles() const { return glm::unpackHalf1x16(particles); }
+	void setParticles(float value) { particles = glm::packHalf1x16(value); }
+#else
 	float particles;
+
+	float getParticles() const { return particles; }
+	void setParticles(float value) { particles = value; }
+#endif
 };
 
 /***************************************************************************//**
@@ -19,8 +33,24 @@ struct WaterData
  ******************************************************************************/
 struct VegetationData
 {
+#ifdef COMPACT_MARKERS
+	// 8 bit fractions, accurate to 0.002
+	unsigned char density;
+	unsigned char waterSupply;
+
+	float getDensity() const { return glm::unpackUnorm1x8(density); }
+	float getWaterSupply() const { return glm::unpackUnorm1x8(waterSupply); }
+	void setDensity(float value) { density = glm::packUnorm1x8(value); }
+	void setWaterSupply(float value) { waterSupply = glm::packUnorm1x8(value); }
+#else
 	float density;
 	float waterSupply;
+
+	float getDensity() const { return density; }
+	float getWaterSupply() const { return waterSupply; }
+	void setDensity(float value) { density = value; }
+	void setWaterSupply(float value) { waterSupply = value; }
+#endif
 };
 
 /***************************************************************************//**
@@ -36,6 +66,18 @@ struct NodeMarker
 	float clayAmount = 0.25f;
 	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
 
+	NodeMarker() = default;
+	NodeMarker(float markerHeight, float markerResistiveForce, bool isHardStop, glm::vec3 markerColor, float markerFertility, float markerSandAmount, float markerClayAmount)
+	{
+		height = markerHeight;
+		resistiveForce = markerResistiveForce;
+		hardStop = isHardStop;
+		color = markerColor;
+		fertility = markerFertility;
+		sandAmount = markerSandAmount;
+		clayAmount = markerClayAmount;
+	}
+
 	/***************************************************************************//**
 	 * Mix the values within this and another marker. 
 	 @param marker The marker to mix with
@@ -52,6 +94,21 @@ struct NodeMarker
 		sandAmount = sandAmount * invWeight + marker.sandAmount * weight;
 		clayAmount = clayAmount * invWeight + marker.clayAmount * weight;
 	}
+
+	/***************************************************************************//**
+	 * The largest difference between the properties of this and another marker,
+	 * as a fraction. Resistive force is compared relative to the larger of the two.
+	 @param marker The marker to compare with
+	 ******************************************************************************/
+	float difference(const NodeMarker& marker) const
+	{
+		glm::vec3 colorDiff = glm::abs(color - marker.color);
+		float diff = glm::abs(resistiveForce - marker.resistiveForce) / glm::max(glm::max(resistiveForce, marker.resistiveForce), 1.0f);
+		diff = glm::max(diff, glm::max(colorDiff.r, glm::max(colorDiff.g, colorDiff.b)));
+		diff = glm::max(diff, glm::abs(fertility - marker.fertility));
+		diff = glm::max(diff, glm::abs(sandAmount - marker.sandAmount));
+		return glm::max(diff, glm::abs(clayAmount - marker.clayAmount));
+	}
 };
 
 /***************************************************************************//**
@@ -110,24 +167,67 @@ struct SoilDefinition
 	}
 };
 
+/***************************************************************************//**
+ * A single column of the map. Soil markers are kept bottom-first within a slot
+ * of the map's ColumnStore, so the surface is always the last marker and can be
+ * deposited onto or eroded without shifting the rest of the column.
+ ******************************************************************************/
 class Node {
+	friend class ColumnStore;
 public:
+	/***************************************************************************//**
+	 * Gives the node an empty column within a store. Must be called before markers are added.
+	 @param store The store to keep the column's markers in
+	 @param capacity The number of markers to make room for
+	 ******************************************************************************/
+	void attach(ColumnStore* store, int capacity);
+	/***************************************************************************//**
+	 * Whether the column is still shared with a snapshot, and will be copied
+	 * into the node's own store when next changed.
+	 ******************************************************************************/
+	bool isShared() const { return m_store != m_owner; }
+	const ColumnStore* getStore() const { return m_store; }
 	void addWater(float height);
 	void addMarker(NodeMarker marker, float& maxHeight);
 	void addMarker(float height, float resistiveForce, bool hardStop, glm::vec3 color, float fertility, float sandAmount, float clayAmount, float& maxHeight);
+	/***************************************************************************//**
+	 * Adds a run of markers at once, for building up whole columns. The column
+	 * is the same as if each marker had been added in turn with addMarker, but
+	 * is allocated and indexed once rather than once per marker.
+	 @param markers The markers to add, sorted bottom first
+	 @param count The number of markers
+	 @param maxHeight The max height of the map, raised to the highest marker
+	 ******************************************************************************/
+	void addMarkers(const NodeMarker* markers, int count, float& maxHeight);
+	/***************************************************************************//**
+	 * Leaves the lowest of the column's generated layers out, to be built the
+	 * first time anything reaches below the layers built so far. Until then the
+	 * column answers everything above that the same as if they were there.
+	 * The layers are built by the subsurface of the store that owns the column.
+	 @param count The number of layers left out, from the bottom of the map up
+	 ******************************************************************************/
+	void deferLayers(int count);
+	bool hasDeferredLayers() const { return m_deferredLayers > 0; }
+	/***************************************************************************//**
+	 * Points a node read back from a file at the store its column was read into,
+	 * as the pointer doesn't survive the file.
+	 @param store The store holding the column
+	 ******************************************************************************/
+	void relink(ColumnStore* store);
 	/***************************************************************************//**
 	 * Erodes the terrain by a height value
 	 @param amount The amount to erode by
 	 ******************************************************************************/
 	void erodeByValue(float amount);
-	float getResistiveForceAtHeight(float height) const;
+	float getResistiveForceAtHeight(float height);
 	/***************************************************************************//**
 	 * Returns a NodeMarker containing all soil data above a given height mixed together.
+	 * Uses the column's soil totals, so the cost doesn't depend on how many layers are mixed.
 	 @param height The height to check above
 	 @param ignoreRock Whether rocks should be considered or not.
 	 ******************************************************************************/
-	NodeMarker getDataAboveHeight(float height, bool ignoreRock = false) const;
-	glm::vec3 getColorAtHeight(float height) const;
+	NodeMarker getDataAboveHeight(float height, bool ignoreRock = false);
+	glm::vec3 getColorAtHeight(float height);
 	/***************************************************************************//**
 	 * Returns the heighest height of the node.
 	 ******************************************************************************/
@@ -136,7 +236,7 @@ public:
 	/***************************************************************************//**
 	 * Returns the topmost marker of the node
 	 ******************************************************************************/
-	NodeMarker* top();
+	NodeMarker top() const;
 	/***************************************************************************//**
 	 * Debug- remove the top layer of the node.
 	 ******************************************************************************/
@@ -162,8 +262,80 @@ public:
 	float getFertility() const;
 	float getFoliageDensity() const;
 	float getFoliageWaterSupply() const;
+	int getMarkerCount() const { return m_count; }
+	/***************************************************************************//**
+	 * Whether markers have been added or eroded since the column was last coalesced.
+	 ******************************************************************************/
+	bool isTouched() const { return m_touched; }
+	/***************************************************************************//**
+	 * Merges neighbouring soil markers with alike properties, to stop columns
+	 * growing forever from deposits. Merged markers take on the thickness-weighted
+	 * mix of both. Hard stops and the surface marker are never merged.
+	 @param tolerance The largest difference in any property to merge, as a fraction
+	 @return The number of markers removed
+	 ******************************************************************************/
+	int coalesce(float tolerance);
+	/***************************************************************************//**
+	 * Ensures the column's slot can hold a number of markers, moving it to a
+	 * larger slot at the end of the store if not.
+	 @param count The number of markers needed
+	 ******************************************************************************/
+	void reserve(int count);
 protected:
-	std::vector<NodeMarker> m_nodeData;
+	/***************************************************************************//**
+	 * Finds the color and resistive force at a height, using binary searches over
+	 * the marker heights and rock counts rather than walking the column.
+	 @param height The height to sample at
+	 @param color Set to the color at the height
+	 @param resistiveForce Set to the resistive force at the height
+	 ******************************************************************************/
+	void sampleAtHeight(float height, glm::vec3& color, float& resistiveForce) const;
+	void insertMarker(int index, const NodeMarker& marker);
+	void eraseMarker(int index);
+	/***************************************************************************//**
+	 * Recounts the hard stops and soil totals below each marker, from a given marker upwards.
+	 @param from The lowest marker whose height, data or position may have changed
+	 ******************************************************************************/
+	void indexColumn(int from);
+	/***************************************************************************//**
+	 * Totals the soil layers below a marker, starting from the nearest stored total.
+	 @param index The marker to total below
+	 ******************************************************************************/
+	SoilSum soilBelow(int index) const;
+	/***************************************************************************//**
+	 * Adds a marker's layer to a running total.
+	 @param sum The total to add to
+	 @param index The marker owning the layer
+	 @param amount The thickness of the layer to add
+	 ******************************************************************************/
+	void addLayer(SoilSum& sum, int index, float amount) const;
+	/***************************************************************************//**
+	 * Builds the column's deferred layers if a height reaches below the built
+	 * ones. Building them doesn't change anything the column answers, but does
+	 * change the column, so the queries that can reach that far aren't const.
+	 @param height The lowest height about to be looked at
+	 ******************************************************************************/
+	void ensureBuiltBelow(float height);
+	void buildDeferredLayers();
+	/***************************************************************************//**
+	 * Copies the column into the node's own store if it's shared with a
+	 * snapshot, or into the store the thread has been redirected to. Must be
+	 * called before the column is changed.
+	 ******************************************************************************/
+	void makeWritable();
+	NodeMarker marker(int index) const { return m_store->get(m_offset + index); }
+	float markerHeight(int index) const { return m_store->heights[m_offset + index]; }
+
+	// The store holding the column, which may be a frozen store shared with snapshots
+	ColumnStore* m_store = nullptr;
+	// The store the column is copied into and changed in
+	ColumnStore* m_owner = nullptr;
+	int m_offset = 0;
+	int m_count = 0;
+	int m_capacity = 0;
+	bool m_touched = false;
+	// Layers at the bottom of the column that haven't been built yet, by the owner's subsurface
+	int m_deferredLayers = 0;
 	WaterData m_waterData;
 	VegetationData m_vegetationData;
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "NoiseCache.h"
+
+#include "PerlinNoise.h"
+
+// Interpolates between b and c, with a and d the points either side of them
+static double catmullRom(double t, double a, double b, double c, double d)
+{
+	return b + 0.5 * t * ((c - a) + t * ((2.0 * a - 5.0 * b + 4.0 * c - d) + t * (3.0 * (b - c) + d - a)));
+}
+
+void NoiseCache::build(PerlinNoise* noise, int width, int height, float period, float z, int spacing)
+{
+	m_spacing = spacing;
+	m_height = height;
+	// Every node needs the lattice point before it and the two after it
+	const int latticeWidth = (width - 1) / spacing + 4;
+	m_latticeHeight = (height - 1) / spacing + 4;
+
+	const int count = latticeWidth * m_latticeHeight;
+	std::vector<double> x(count), y(count), zs(count, z);
+	for (int i = 0; i < latticeWidth; ++i)
+	{
+		for (int j = 0; j < m_latticeHeight; ++j)
+		{
+			x[i * m_latticeHeight + j] = (i - 1) * spacing / (double)period;
+			y[i * m_latticeHeight + j] = (j - 1) * spacing / (double)period;
+		}
+	}
+
+	m_lattice.resize(count);
+	noise->noise(x.data(), y.data(), zs.data(), m_lattice.data(), count);
+}
+
+void NoiseCache::sampleRow(int x, std::vector<double>& values) const
+{
+	// Interpolate along the row's lattice columns first, leaving one spline to follow down the row
+	const int i = x / m_spacing + 1;
+	const double t = (x % m_spacing) / (double)m_spacing;
+	const double* columns[4];
+	for (int c = 0; c < 4; ++c)
+		columns[c] = &m_lattice[(i - 1 + c) * m_latticeHeight];
+
+	std::vector<double> row(m_latticeHeight);
+	for (int j = 0; j < m_latticeHeight; ++j)
+		row[j] = catmullRom(t, columns[0][j], columns[1][j], columns[2][j], columns[3][j]);
+
+	values.resize(m_height);
+	for (int y = 0; y < m_height; ++y)
+	{
+		const int j = y / m_spacing + 1;
+		values[y] = catmullRom((y % m_spacing) / (double)m_spacing, row[j - 1], row[j], row[j + 1], row[j + 2]);
+	}
+}
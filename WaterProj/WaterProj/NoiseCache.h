@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+class PerlinNoise;
+
+/***************************************************************************//**
+ * A low resolution copy of a slice of noise that changes slowly across the
+ * map, for generation. The noise is sampled on a lattice every few nodes, and
+ * the value at each node is interpolated from the 4x4 lattice points around
+ * it with Catmull-Rom splines, which is far cheaper than sampling every node
+ * when features span hundreds of nodes.
+ ******************************************************************************/
+class NoiseCache
+{
+public:
+	/***************************************************************************//**
+	 * Samples the lattice. Node (x, y) lies at (x / period, y / period, z) in the noise.
+	 @param noise The noise to sample
+	 @param width The width of the map
+	 @param height The height of the map
+	 @param period The number of nodes per unit of noise
+	 @param z The height the noise is sampled at
+	 @param spacing The number of nodes between lattice points
+	 ******************************************************************************/
+	void build(PerlinNoise* noise, int width, int height, float period, float z, int spacing);
+	bool isBuilt() const { return m_spacing > 0; }
+	/***************************************************************************//**
+	 * Interpolates the noise for every node in a row.
+	 @param x The X coordinate of the row
+	 @param values Filled with the noise at each node in the row
+	 ******************************************************************************/
+	void sampleRow(int x, std::vector<double>& values) const;
+
+protected:
+	// Lattice points, column by column, with an extra point before and two after the map on each axis
+	std::vector<double> m_lattice;
+	int m_spacing = 0;
+	int m_latticeHeight = 0;
+	int m_height = 0;
+};
@@ -1,39 +1,25 @@
 #include "Plant.h"
 
+#include "HaloGrid.h"
 #include "Node.h"
 
-void Plant::root(Node* nodes, glm::ivec2 dim, glm::ivec2 pos, float foliageDensity) 
+void Plant::root(Node* nodes, const HaloGrid& grid, glm::ivec2 pos, float foliageDensity) 
 {
-    int index = pos.y * dim.x + pos.x;
+    const int center = grid.haloIndex(pos.x, pos.y);
+    const int stride = grid.getStride();
+    int index = grid.entry(center);
     float fertility = getFertilityForNode(nodes + index);
     nodes[index].setFoliageDensity(nodes[index].getFoliageDensity() + foliageDensity * fertility);
 
-    // Populate all surrounding nodes by a reduced factor
-    if (pos.y > 0) {
-        nodes[index - dim.x].setFoliageDensity(nodes[index - dim.x].getFoliageDensity() + foliageDensity * 0.6 * fertility);
-
-        if (pos.x > 0)
-            nodes[index - dim.x - 1].setFoliageDensity(nodes[index - dim.x - 1].getFoliageDensity() + foliageDensity * 0.4 * fertility);
-
-        if (pos.x < dim.x - 1)
-            nodes[index - dim.x + 1].setFoliageDensity(nodes[index - dim.x + 1].getFoliageDensity() + foliageDensity * 0.4 * fertility); 
-    }
-
-    if (pos.y < dim.y - 1) {
-        nodes[index + dim.x].setFoliageDensity(nodes[index + dim.x].getFoliageDensity() + foliageDensity * 0.6 * fertility);
-
-        if (pos.x > 0)
-            nodes[index + dim.x - 1].setFoliageDensity(nodes[index + dim.x - 1].getFoliageDensity() + foliageDensity * 0.4 * fertility);
-
-        if (pos.x < dim.x - 1)
-            nodes[index + dim.x + 1].setFoliageDensity(nodes[index + dim.x + 1].getFoliageDensity() + foliageDensity * 0.4 * fertility); 
+    // Populate all surrounding nodes by a reduced factor, leaving out any off the map
+    const int offsets[8] = { -stride, -stride - 1, -stride + 1, stride, stride - 1, stride + 1, -1, 1 };
+    const double factors[8] = { 0.6, 0.4, 0.4, 0.6, 0.4, 0.4, 0.6, 0.6 };
+    for (int i = 0; i < 8; ++i)
+    {
+        const int neighbour = grid.entry(center + offsets[i]);
+        if (HaloGrid::isInside(neighbour))
+            nodes[neighbour].setFoliageDensity(nodes[neighbour].getFoliageDensity() + foliageDensity * factors[i] * fertility);
     }
-
-    if (pos.x > 0)
-        nodes[index - 1].setFoliageDensity(nodes[index - 1].getFoliageDensity() + foliageDensity * 0.6 * fertility); 
-
-    if (pos.x < dim.x - 1)
-        nodes[index + 1].setFoliageDensity(nodes[index + 1].getFoliageDensity() + foliageDensity * 0.6 * fertility);
 }
 
 float Plant::getFertilityForNode(const Node* node)
@@ -1,6 +1,7 @@
 #pragma once
 #include <glm.hpp>
 
+class HaloGrid;
 class Node;
 
 /***************************************************************************//**
@@ -11,11 +12,11 @@ public:
 	/***************************************************************************//**
 	 * Root a plant at the given location. Will increase both the current and surrounding node foliage densities
 	 @param nodes The nodes that make up the map data
-	 @param dim The size of the map
+	 @param grid The halo grid over the nodes, for finding neighbours
 	 @param pos The position to root from
 	 @param foliageDensity The amount of foliage to place
 	 ******************************************************************************/
-    static void root(Node* nodes, glm::ivec2 dim, glm::ivec2 pos, float foliageDensity);
+    static void root(Node* nodes, const HaloGrid& grid, glm::ivec2 pos, float foliageDensity);
 	/***************************************************************************//**
 	 * Calculates fertility for the given node
 	 @param node The node to check fertility of
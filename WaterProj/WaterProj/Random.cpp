@@ -0,0 +1,23 @@
+#include "Random.h"
+
+// The SplitMix64 finaliser. Every bit of the input affects every bit of the output.
+static unsigned long long mix(unsigned long long value)
+{
+	value += 0x9E3779B97F4A7C15ull;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+	return value ^ (value >> 31);
+}
+
+Random::Random(unsigned int seed)
+{
+	m_seed = seed;
+	m_key = mix(seed);
+}
+
+unsigned int Random::get(int stage, glm::ivec2 cell, int iteration) const
+{
+	const unsigned long long position = ((unsigned long long)(unsigned int)cell.y << 32) | (unsigned int)cell.x;
+	const unsigned long long counter = ((unsigned long long)(unsigned int)stage << 32) | (unsigned int)iteration;
+	return (unsigned int)(mix(mix(m_key ^ counter) ^ position) >> 32);
+}
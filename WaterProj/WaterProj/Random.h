@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm.hpp>
+
+/***************************************************************************//**
+ * Defines for what a random number is drawn for. Each use of randomness gets
+ * its own stage, so that no two uses ever draw the same number.
+ ******************************************************************************/
+enum randomStage : int
+{
+	RandomStage_NoiseSeed,
+	RandomStage_Tree,
+	RandomStage_Spring,
+	RandomStage_DropX,
+	RandomStage_DropY,
+	RandomStage_LongDistanceTree,
+	RandomStage_TreeSpread,
+	RandomStage_TreeSpreadX,
+	RandomStage_TreeSpreadY,
+	RandomStage_TreeDeath,
+};
+
+/***************************************************************************//**
+ * A counter based random number generator. Rather than stepping a shared
+ * state, every number is a hash of the seed and what it is drawn for: the
+ * stage, the cell (or anything else being counted through, like drops) and
+ * the iteration. The same draw always gives the same number, whatever order
+ * draws are made in and whichever thread makes them.
+ ******************************************************************************/
+class Random
+{
+public:
+	/***************************************************************************//**
+	 * Creates a generator.
+	 @param seed The seed all numbers are drawn from
+	 ******************************************************************************/
+	Random(unsigned int seed = 0);
+
+	/***************************************************************************//**
+	 * Draws a random number.
+	 @param stage What the number is for, from randomStage
+	 @param cell The position of the cell the number is for, or a count in X for draws not tied to a cell
+	 @param iteration The iteration of the simulation the number is drawn in
+	 ******************************************************************************/
+	unsigned int get(int stage, glm::ivec2 cell, int iteration) const;
+	/***************************************************************************//**
+	 * Draws a random number from 0 up to, but not including, max.
+	 ******************************************************************************/
+	int range(int stage, glm::ivec2 cell, int iteration, int max) const { return (int)(get(stage, cell, iteration) % (unsigned int)max); }
+	unsigned int getSeed() const { return m_seed; }
+
+protected:
+	unsigned int m_seed;
+	// The seed, mixed so that neighbouring seeds give unrelated numbers
+	unsigned long long m_key;
+};
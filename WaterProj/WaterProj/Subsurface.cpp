@@ -0,0 +1,200 @@
+#include "Subsurface.h"
+
+Subsurface::Subsurface(const PerlinNoise& resistivityNoise, const PerlinNoise& rockNoise, const MapParams& params, float maxHeight)
+	: m_resistivityNoise(resistivityNoise), m_rockNoise(rockNoise), m_params(params), m_maxHeight(maxHeight)
+{
+}
+
+glm::ivec2 Subsurface::getInitialLayers(float surfaceHeight) const
+{
+	const float incrementValue = 1.0f / (float)m_params.generatedMapDensity;
+	const float maxHeightScaled = surfaceHeight / m_maxHeight;
+	glm::ivec2 layers(0, 0);
+
+	for (float currHeight = 0.0f; currHeight < maxHeightScaled; currHeight += incrementValue)
+	{
+		if (m_params.lazySubsurfaceDepth > 0.0f && currHeight * m_maxHeight < surfaceHeight - m_params.lazySubsurfaceDepth)
+			layers.x++;
+		layers.y++;
+	}
+
+	// Split on a block boundary, so that simplifying each part gives the same markers as simplifying the whole column
+	layers.x -= layers.x % SIMPLIFY_BLOCK_LAYERS;
+	return layers;
+}
+
+void Subsurface::generate(int x, int y, int count, const glm::ivec2* ranges, std::vector<NodeMarker>& layers, std::vector<int>& starts)
+{
+	const float incrementValue = 1.0f / (float)m_params.generatedMapDensity;
+	layers.clear();
+	starts.clear();
+
+	// Every height a layer could start at is gathered for all the columns, so their noise is sampled in two batches.
+	// A column starting part way up also gets the layer below its first, to tell whether it starts inside rock.
+	std::vector<float> heights;
+	std::vector<int> heightLayers;
+	std::vector<int> columnStarts(count + 1);
+	std::vector<char> hasLayerBelow(count, 0);
+	for (int c = 0; c < count; ++c)
+	{
+		columnStarts[c] = heights.size();
+		const int first = glm::max(ranges[c].x - 1, 0);
+		float currHeight = 0.0f;
+		for (int layer = 0; layer < ranges[c].y; ++layer, currHeight += incrementValue)
+		{
+			if (layer < first || currHeight * m_maxHeight < BEDROCK_SAFETY_LAYER)
+				continue;
+
+			if (layer < ranges[c].x)
+				hasLayerBelow[c] = 1;
+			heights.push_back(currHeight);
+			heightLayers.push_back(layer);
+		}
+	}
+	columnStarts[count] = heights.size();
+
+	// Soil noise is only used where there's no rock, but is sampled at every height to keep the batch whole
+	NoiseBatch batch;
+	std::vector<double> rock, soil;
+	batch.resize(heights.size());
+	for (int c = 0; c < count; ++c)
+	{
+		for (int i = columnStarts[c]; i < columnStarts[c + 1]; ++i)
+			batch.set(i, x / (m_params.rockRarity / m_params.scale), (y + c) / (m_params.rockRarity / m_params.scale), heights[i] * m_params.rockVerticalScaling);
+	}
+	batch.sample(&m_rockNoise, rock);
+	for (int c = 0; c < count; ++c)
+	{
+		for (int i = columnStarts[c]; i < columnStarts[c + 1]; ++i)
+			batch.set(i, x / (m_params.soilResistivityChangeRate / m_params.scale), (y + c) / (m_params.soilResistivityChangeRate / m_params.scale), heights[i] * m_params.rockVerticalScaling);
+	}
+	batch.sample(&m_resistivityNoise, soil);
+
+	std::vector<NodeMarker> column;
+	std::vector<int> columnLayers;
+	for (int c = 0; c < count; ++c)
+	{
+		bool isRock = false;
+		starts.push_back(layers.size());
+		column.clear();
+		columnLayers.clear();
+
+		int i = columnStarts[c];
+		if (hasLayerBelow[c])
+		{
+			// Noise exactly on the threshold leaves the rock as it was, so only then does it need to look further down
+			float belowVal = rock[i++];
+			if (belowVal == m_params.rockThreshold)
+				isRock = isRockBelow(x, y + c, ranges[c].x - 1);
+			else
+				isRock = belowVal > m_params.rockThreshold;
+		}
+
+		for (; i < columnStarts[c + 1]; ++i)
+		{
+			const float currHeight = heights[i];
+			// rock resistiveForce (3.8-4.2g/cm3)
+			float currVal = rock[i];
+			const size_t markers = column.size();
+			if (!isRock)
+			{
+				if (currVal > m_params.rockThreshold)
+				{
+					float resistivity = m_params.rockResistivityBase + (currVal - m_params.rockThreshold) * m_params.rockResistivityVariance;
+					column.push_back(NodeMarker(currHeight * m_maxHeight, resistivity, true, glm::vec3(0.1f, 0.1f, 0.1f) + glm::vec3(0.5f, 0.5f, 0.5f) * currVal, 0.0f, 0.0f, 0.0f));
+					isRock = true;
+				}
+				else
+				{
+					// soil resistiveForce (2.3-2.6g/cm3, increasing with depth)
+					float noise = soil[i];
+					float resistivity = m_params.soilResistivityBase + glm::max(0.0f, 0.5f - currHeight) + noise * m_params.soilResistivityVariance;
+					float sandAmount = m_params.soilSandContent + noise * m_params.soilSandVariance;
+					float clayAmount = m_params.soilClayContent + noise * m_params.soilClayVariance;
+					glm::vec3 col = glm::vec3(0.2f + noise * 0.2f, 0.3f, 0.0f);
+					column.push_back(NodeMarker(currHeight * m_maxHeight, resistivity, false, col, m_params.soilFertility, sandAmount, clayAmount));
+				}
+			}
+			else if (currVal < m_params.rockThreshold)
+			{
+				float resistivity = m_params.rockResistivityBase + (currVal - m_params.rockThreshold) * m_params.rockResistivityVariance;
+				column.push_back(NodeMarker(currHeight * m_maxHeight, resistivity, true, glm::vec3(0.1f, 0.1f, 0.1f) + glm::vec3(0.5f, 0.5f, 0.5f) * currVal, 0.0f, 0.0f, 0.0f));
+				isRock = false;
+			}
+
+			if (column.size() > markers)
+				columnLayers.push_back(heightLayers[i]);
+		}
+
+		if (m_params.generatedMarkerTolerance > 0.0f)
+			simplify(column, columnLayers, layers);
+		else
+			layers.insert(layers.end(), column.begin(), column.end());
+	}
+	starts.push_back(layers.size());
+}
+
+void Subsurface::simplify(const std::vector<NodeMarker>& column, const std::vector<int>& columnLayers, std::vector<NodeMarker>& layers) const
+{
+	const float tolerance = m_params.generatedMarkerTolerance;
+
+	// A marker can be left out if the one below it and the line between the markers either side both describe it
+	auto describes = [&](int low, int high)
+	{
+		for (int i = low + 1; i < high; ++i)
+		{
+			NodeMarker between = column[low];
+			between.mix(column[high], (column[i].height - column[low].height) / (column[high].height - column[low].height));
+			if (column[i].difference(column[low]) > tolerance || column[i].difference(between) > tolerance)
+				return false;
+		}
+		return true;
+	};
+
+	int i = 0;
+	while (i < (int)column.size())
+	{
+		// Soil markers are simplified in runs broken by rock and block boundaries, keeping the ends of every run
+		int end = i + 1;
+		if (!column[i].hardStop)
+		{
+			while (end < (int)column.size() && !column[end].hardStop && columnLayers[end] / SIMPLIFY_BLOCK_LAYERS == columnLayers[i] / SIMPLIFY_BLOCK_LAYERS)
+				++end;
+		}
+
+		// Stretch each kept marker's reach up the run as far as it'll go
+		int kept = i;
+		layers.push_back(column[kept]);
+		for (int next = kept + 2; next < end; ++next)
+		{
+			if (!describes(kept, next))
+			{
+				kept = next - 1;
+				layers.push_back(column[kept]);
+			}
+		}
+		if (end - 1 > kept)
+			layers.push_back(column[end - 1]);
+
+		i = end;
+	}
+}
+
+bool Subsurface::isRockBelow(int x, int y, int layer)
+{
+	const float incrementValue = 1.0f / (float)m_params.generatedMapDensity;
+	std::vector<float> heights(layer);
+	float currHeight = 0.0f;
+	for (int i = 0; i < layer; ++i, currHeight += incrementValue)
+		heights[i] = currHeight;
+
+	// Rock starts above the threshold and ends below it, so walk down to the first layer that isn't exactly on it
+	for (int i = layer - 1; i >= 0 && heights[i] * m_maxHeight >= BEDROCK_SAFETY_LAYER; --i)
+	{
+		float currVal = m_rockNoise.noise(x / (m_params.rockRarity / m_params.scale), y / (m_params.rockRarity / m_params.scale), heights[i] * m_params.rockVerticalScaling);
+		if (currVal != m_params.rockThreshold)
+			return currVal > m_params.rockThreshold;
+	}
+
+	return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm.hpp>
+#include <vector>
+
+#include "Map.h"
+#include "PerlinNoise.h"
+
+// Generated markers are simplified in blocks of this many layers, keeping the markers either side of each block's
+// edges, so that a column comes out the same whether its layers are generated all at once or in parts
+#define SIMPLIFY_BLOCK_LAYERS 16
+
+/***************************************************************************//**
+ * Generates the rock and soil layers under the surface of the map. Layers lie
+ * at fixed steps of the map's height, from the bottom of the map up to each
+ * node's surface. Whether a layer is rock only depends on the noise at its own
+ * height and the layer below it, so any run of a column's layers can be
+ * generated apart from the rest and still come out the same.
+ *
+ * This lets the deep layers of a column be left out when the map is generated,
+ * and built when something first reaches down to them.
+ *
+ * Layers are sampled at every step, but with generatedMarkerTolerance set, only
+ * soil markers that the markers around them don't describe well enough are
+ * kept. Every property at every height then stays within the tolerance of a
+ * column with a marker at every step, whether it's read as a layer or
+ * interpolated between markers.
+ ******************************************************************************/
+class Subsurface
+{
+public:
+	/***************************************************************************//**
+	 * Keeps copies of the noise and parameters, so layers can be generated long after the map was.
+	 @param resistivityNoise noise for soil resistivity
+	 @param rockNoise noise for rock generation (at heigher values rocks will generate)
+	 @param params Defines for generation
+	 @param maxHeight The max height of the map once its surface has been generated, which layers are spaced by
+	 ******************************************************************************/
+	Subsurface(const PerlinNoise& resistivityNoise, const PerlinNoise& rockNoise, const MapParams& params, float maxHeight);
+	/***************************************************************************//**
+	 * Finds the layers of a column to build when the map is generated. That's all
+	 * of them, or only those within lazySubsurfaceDepth of the surface if it's set.
+	 @param surfaceHeight The height of the column's surface when generated
+	 @return The first layer to build, and one past the column's top layer
+	 ******************************************************************************/
+	glm::ivec2 getInitialLayers(float surfaceHeight) const;
+	/***************************************************************************//**
+	 * Samples the noise for runs of the layers under a run of columns, a batch of
+	 * layers at a time. Safe to call from several threads at once.
+	 @param x The X coordinate of the columns
+	 @param y The Y coordinate of the first column
+	 @param count The number of columns, running along Y
+	 @param ranges The first layer and one past the last to generate, for each column
+	 @param layers Filled with the markers of every column, bottom first. Layers inside rock have no marker of their own.
+	 @param starts Filled with where each column's markers start, plus the end of the last column's
+	 ******************************************************************************/
+	void generate(int x, int y, int count, const glm::ivec2* ranges, std::vector<NodeMarker>& layers, std::vector<int>& starts);
+
+protected:
+	/***************************************************************************//**
+	 * Works out whether a column is inside rock just below a layer, from the layers below it.
+	 @param x The X coordinate of the column
+	 @param y The Y coordinate of the column
+	 @param layer The layer to look below
+	 ******************************************************************************/
+	bool isRockBelow(int x, int y, int layer);
+	/***************************************************************************//**
+	 * Leaves out the soil markers of a column that are within generatedMarkerTolerance
+	 * of both the marker below them and the line between the markers kept either side.
+	 @param column The markers of the column, bottom first
+	 @param columnLayers The layer each marker was generated at
+	 @param layers The kept markers are added to the end of this
+	 ******************************************************************************/
+	void simplify(const std::vector<NodeMarker>& column, const std::vector<int>& columnLayers, std::vector<NodeMarker>& layers) const;
+
+	PerlinNoise m_resistivityNoise;
+	PerlinNoise m_rockNoise;
+	MapParams m_params;
+	float m_maxHeight;
+};
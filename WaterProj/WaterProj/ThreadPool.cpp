@@ -0,0 +1,76 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads)
+{
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+
+	for (int i = 1; i < threads; ++i)
+		m_workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& task)
+{
+	// Not worth waking anyone for
+	if (m_workers.empty() || count <= 1)
+	{
+		for (int i = 0; i < count; ++i)
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_count = count;
+		m_next = 0;
+		m_busy = (int)m_workers.size();
+		++m_batch;
+	}
+	m_wake.notify_all();
+
+	drain();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_finished.wait(lock, [this] { return m_busy == 0; });
+	m_task = nullptr;
+}
+
+void ThreadPool::work()
+{
+	unsigned int batch = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stopping || m_batch != batch; });
+			if (m_stopping)
+				return;
+			batch = m_batch;
+		}
+
+		drain();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_busy == 0)
+			m_finished.notify_one();
+	}
+}
+
+void ThreadPool::drain()
+{
+	for (int i = m_next++; i < m_count; i = m_next++)
+		(*m_task)(i);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/***************************************************************************//**
+ * A fixed set of worker threads that share out numbered tasks. The calling
+ * thread works through tasks alongside the workers, and waits for all of them
+ * to finish before returning.
+ *
+ * Tasks are handed out in whatever order threads become free, so a task
+ * should only write to results belonging to its own number. Anything that
+ * depends on order (random numbers, allocating from shared stores) has to be
+ * done by the caller, before or after the tasks run.
+ ******************************************************************************/
+class ThreadPool
+{
+public:
+	/***************************************************************************//**
+	 * Starts the worker threads.
+	 @param threads The number of threads to work with, including the calling thread. 0 for one per hardware thread.
+	 ******************************************************************************/
+	ThreadPool(int threads = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/***************************************************************************//**
+	 * Runs a task for every number from 0 up to count, returning when they've all finished.
+	 @param count The number of tasks
+	 @param task The work to do, given the number of the task
+	 ******************************************************************************/
+	void run(int count, const std::function<void(int)>& task);
+	// The number of threads tasks are shared between, including the calling thread
+	int getThreadCount() const { return (int)m_workers.size() + 1; }
+
+protected:
+	void work();
+	// Takes tasks until there are none left
+	void drain();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_finished;
+	const std::function<void(int)>* m_task = nullptr;
+	int m_count = 0;
+	std::atomic<int> m_next{ 0 };
+	// Workers still working on the current batch
+	int m_busy = 0;
+	// Bumped for every batch, so workers can tell a new batch from a spurious wake
+	unsigned int m_batch = 0;
+	bool m_stopping = false;
+};
@@ -3,9 +3,13 @@
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 
+#include "Benchmark.h"
 #include "Map.h"
+#include "MapBuilder.h"
 #include "MapRenderer.h"
 
+//#define RUNBENCHMARKS
+
 SDL_Window* makeSDLWindow()
 {
 	// Init SDL
@@ -39,7 +43,7 @@ void printControls()
 {
 	std::cout << "\nControls:\n";
 	std::cout << "ESC: Quit\n";
-	std::cout << "R: Generate new map\n";
+	std::cout << "R: Generate new map, or reload params and regenerate the map if its seed is entered\n";
 	std::cout << "W,A,S,D: Transform camera\n";
 	std::cout << "Q,E: Zoom in, zoom out\n";
 	std::cout << "P: Play/pause simulation\n";
@@ -76,14 +80,30 @@ unsigned int getSeed()
 	return seed;
 }
 
+/***************************************************************************//**
+ * Whether a key acts on the map itself, rather than just the view of it.
+ @param key The key pressed
+ ******************************************************************************/
+bool usesMap(SDL_Keycode key)
+{
+	return key == SDLK_r || key == SDLK_p || key == SDLK_2 || key == SDLK_3 || key == SDLK_4 || key == SDLK_7 || key == SDLK_8 || key == SDLK_9;
+}
+
 int main()
 {
+#ifdef RUNBENCHMARKS
+	Benchmark::run();
+	return 0;
+#endif
+
 	SDL_Window* window = makeSDLWindow();
 	unsigned int seed = getSeed();
 
 	MapParams params;
 	params.loadFromFile();
-	Map* currentMap = new Map(1000, 1000, params, seed);
+	// The preview is shown until the map is built, which is swapped in as soon as it's ready
+	MapBuilder* builder = new MapBuilder(1000, 1000, params, seed);
+	Map* currentMap = builder->getPreview();
 	MapRenderer renderer(currentMap);
 	renderer.render(window);
 	printControls();
@@ -104,13 +124,27 @@ int main()
 				exit = true;
 				break;
 			case SDL_KEYDOWN:
+				// Only the view can be changed while the map is being built
+				if (builder && usesMap(event.key.keysym.sym))
+				{
+					std::cout << "The map is still being generated" << std::endl;
+				}
 				// Change map
-				if (event.key.keysym.sym == SDLK_r)
+				else if (event.key.keysym.sym == SDLK_r)
 				{
-					delete(currentMap);
 					seed = getSeed();
 					params.loadFromFile();
-					currentMap = new Map(1000, 1000, params, seed);
+					// Keeping the seed keeps the map, generating again only what the changed parameters affect
+					if (seed == currentMap->getSeed())
+					{
+						builder = new MapBuilder(currentMap, params);
+					}
+					else
+					{
+						delete(currentMap);
+						builder = new MapBuilder(1000, 1000, params, seed);
+					}
+					currentMap = builder->getPreview();
 					renderer.setMap(currentMap);
 					printControls();
 					heightDisplayMode = false;
@@ -240,7 +274,16 @@ int main()
 			}
 		}
 
-		if (erosionEnabled)
+		if (builder && builder->isFinished())
+		{
+			currentMap = builder->takeMap();
+			delete(builder);
+			builder = nullptr;
+			renderer.swapMap(currentMap);
+			heightDisplayMode ? renderer.renderAtHeight(window, height) : renderer.render(window);
+		}
+
+		if (erosionEnabled && !builder)
 		{
 			auto start = std::chrono::system_clock::now();
 			currentMap->erode(100);
@@ -255,5 +298,8 @@ int main()
 		}
 	}
 
-	delete(currentMap);
+	if (builder)
+		delete(builder);
+	else
+		delete(currentMap);
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 #include <random>
 #include <algorithm>
 #include <numeric>
+#include "PerlinNoiseSimd.h"
+#if defined(_MSC_VER) && defined(PERLIN_SIMD)
+#include <intrin.h>
+#endif
 
 // THIS IS A DIRECT TRANSLATION TO C++11 FROM THE REFERENCE
 // JAVA IMPLEMENTATION OF THE IMPROVED PERLIN FUNCTION (see http://mrl.nyu.edu/~perlin/noise/)
@@ -77,6 +81,95 @@ double PerlinNoise::noise(double x, double y, double z) {
 	return (res + 1.0)/2.0;
 }
 
+float PerlinNoise::noiseFloat(float x, float y, float z) {
+	// The same steps as the double precision version
+	int X = (int) std::floor(x) & 255;
+	int Y = (int) std::floor(y) & 255;
+	int Z = (int) std::floor(z) & 255;
+
+	x -= std::floor(x);
+	y -= std::floor(y);
+	z -= std::floor(z);
+
+	float u = fade(x);
+	float v = fade(y);
+	float w = fade(z);
+
+	int A = p[X] + Y;
+	int AA = p[A] + Z;
+	int AB = p[A + 1] + Z;
+	int B = p[X + 1] + Y;
+	int BA = p[B] + Z;
+	int BB = p[B + 1] + Z;
+
+	float res = lerp(w, lerp(v, lerp(u, grad(p[AA], x, y, z), grad(p[BA], x-1, y, z)), lerp(u, grad(p[AB], x, y-1, z), grad(p[BB], x-1, y-1, z))),	lerp(v, lerp(u, grad(p[AA+1], x, y, z-1), grad(p[BA+1], x-1, y, z-1)), lerp(u, grad(p[AB+1], x, y-1, z-1),	grad(p[BB+1], x-1, y-1, z-1))));
+	return (res + 1.0f)/2.0f;
+}
+
+// The best instruction set the CPU and OS support
+static PerlinNoise::SimdLevel detectSimdLevel() {
+#if defined(_MSC_VER) && defined(PERLIN_SIMD)
+	int info[4];
+	__cpuid(info, 0);
+	const int highestId = info[0];
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	// AVX registers are only usable if the OS saves them on a context switch
+	const bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+	if (avx && highestId >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+	if (avx2)
+		return PerlinNoise::SimdLevel::AVX2;
+	if (sse41)
+		return PerlinNoise::SimdLevel::SSE41;
+#elif defined(__GNUC__) && defined(PERLIN_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return PerlinNoise::SimdLevel::AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return PerlinNoise::SimdLevel::SSE41;
+#endif
+	return PerlinNoise::SimdLevel::Scalar;
+}
+
+PerlinNoise::SimdLevel PerlinNoise::s_simdLevel = detectSimdLevel();
+
+PerlinNoise::SimdLevel PerlinNoise::getSimdLevel() {
+	return s_simdLevel;
+}
+
+void PerlinNoise::setSimdLevel(SimdLevel level) {
+	s_simdLevel = std::min(level, detectSimdLevel());
+}
+
+void PerlinNoise::noise(const double* x, const double* y, const double* z, double* out, int count) {
+	int done = 0;
+#ifdef PERLIN_SIMD
+	if (s_simdLevel == SimdLevel::AVX2)
+		done = perlinNoiseAVX2(p.data(), x, y, z, out, count);
+	else if (s_simdLevel == SimdLevel::SSE41)
+		done = perlinNoiseSSE41(p.data(), x, y, z, out, count);
+#endif
+	// Whatever doesn't fill a whole vector
+	for (int i = done; i < count; ++i)
+		out[i] = noise(x[i], y[i], z[i]);
+}
+
+void PerlinNoise::noise(const float* x, const float* y, const float* z, float* out, int count) {
+	int done = 0;
+#ifdef PERLIN_SIMD
+	if (s_simdLevel == SimdLevel::AVX2)
+		done = perlinNoiseAVX2(p.data(), x, y, z, out, count);
+	else if (s_simdLevel == SimdLevel::SSE41)
+		done = perlinNoiseSSE41(p.data(), x, y, z, out, count);
+#endif
+	for (int i = done; i < count; ++i)
+		out[i] = noiseFloat(x[i], y[i], z[i]);
+}
+
 double PerlinNoise::fade(double t) { 
 	return t * t * t * (t * (t * 6 - 15) + 10);
 }
@@ -92,3 +185,18 @@ double PerlinNoise::grad(int hash, double x, double y, double z) {
 		   v = h < 4 ? y : h == 12 || h == 14 ? x : z;
 	return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
+
+float PerlinNoise::fade(float t) {
+	return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+float PerlinNoise::lerp(float t, float a, float b) {
+	return a + t * (b - a);
+}
+
+float PerlinNoise::grad(int hash, float x, float y, float z) {
+	int h = hash & 15;
+	float u = h < 8 ? x : y,
+		  v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+	return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+}
@@ -0,0 +1,69 @@
+// AVX2 kernels for PerlinNoise, only called when the CPU and OS support AVX2.
+// FMA is left off on purpose, as fused multiply-adds round differently to the scalar code.
+
+// GCC needs the target set before the kernel template is defined, so that it's instantiated for it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#pragma GCC target("avx2")
+#endif
+
+#include "PerlinNoiseSimd.h"
+
+#ifdef PERLIN_SIMD
+
+namespace {
+
+struct AVX2Double {
+	typedef double Scalar;
+	typedef __m256d Real;
+	typedef __m128i Int;
+	static const int Count = 4;
+
+	static Real load(const double* values) { return _mm256_loadu_pd(values); }
+	static void store(double* values, Real value) { _mm256_storeu_pd(values, value); }
+	static Real set(double value) { return _mm256_set1_pd(value); }
+	static Real add(Real a, Real b) { return _mm256_add_pd(a, b); }
+	static Real sub(Real a, Real b) { return _mm256_sub_pd(a, b); }
+	static Real mul(Real a, Real b) { return _mm256_mul_pd(a, b); }
+	static Real div(Real a, Real b) { return _mm256_div_pd(a, b); }
+	static Real floor(Real value) { return _mm256_floor_pd(value); }
+	static Int toInt(Real value) { return _mm256_cvtpd_epi32(value); }
+	static Int setInt(int value) { return _mm_set1_epi32(value); }
+	static Int addInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+	static Int andInt(Int a, Int b) { return _mm_and_si128(a, b); }
+	static Int gather(const int* table, Int index) { return _mm_i32gather_epi32(table, index, 4); }
+	static Real lookup(const double* table, Int index) { return _mm256_i32gather_pd(table, index, 8); }
+};
+
+struct AVX2Float {
+	typedef float Scalar;
+	typedef __m256 Real;
+	typedef __m256i Int;
+	static const int Count = 8;
+
+	static Real load(const float* values) { return _mm256_loadu_ps(values); }
+	static void store(float* values, Real value) { _mm256_storeu_ps(values, value); }
+	static Real set(float value) { return _mm256_set1_ps(value); }
+	static Real add(Real a, Real b) { return _mm256_add_ps(a, b); }
+	static Real sub(Real a, Real b) { return _mm256_sub_ps(a, b); }
+	static Real mul(Real a, Real b) { return _mm256_mul_ps(a, b); }
+	static Real div(Real a, Real b) { return _mm256_div_ps(a, b); }
+	static Real floor(Real value) { return _mm256_floor_ps(value); }
+	static Int toInt(Real value) { return _mm256_cvtps_epi32(value); }
+	static Int setInt(int value) { return _mm256_set1_epi32(value); }
+	static Int addInt(Int a, Int b) { return _mm256_add_epi32(a, b); }
+	static Int andInt(Int a, Int b) { return _mm256_and_si256(a, b); }
+	static Int gather(const int* table, Int index) { return _mm256_i32gather_epi32(table, index, 4); }
+	static Real lookup(const float* table, Int index) { return _mm256_i32gather_ps(table, index, 4); }
+};
+
+}
+
+int perlinNoiseAVX2(const int* p, const double* x, const double* y, const double* z, double* out, int count) {
+	return perlinNoiseKernel<AVX2Double>(p, x, y, z, out, count);
+}
+
+int perlinNoiseAVX2(const int* p, const float* x, const float* y, const float* z, float* out, int count) {
+	return perlinNoiseKernel<AVX2Float>(p, x, y, z, out, count);
+}
+
+#endif
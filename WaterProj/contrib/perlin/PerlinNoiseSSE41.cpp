@@ -0,0 +1,74 @@
+// SSE4.1 kernels for PerlinNoise, only called when the CPU supports SSE4.1.
+// SSE has no gather, so table lookups are made a lane at a time.
+
+// GCC needs the target set before the kernel template is defined, so that it's instantiated for it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#pragma GCC target("sse4.1")
+#endif
+
+#include "PerlinNoiseSimd.h"
+
+#ifdef PERLIN_SIMD
+
+namespace {
+
+struct SSE41Double {
+	typedef double Scalar;
+	typedef __m128d Real;
+	// Only the low two lanes are used
+	typedef __m128i Int;
+	static const int Count = 2;
+
+	static Real load(const double* values) { return _mm_loadu_pd(values); }
+	static void store(double* values, Real value) { _mm_storeu_pd(values, value); }
+	static Real set(double value) { return _mm_set1_pd(value); }
+	static Real add(Real a, Real b) { return _mm_add_pd(a, b); }
+	static Real sub(Real a, Real b) { return _mm_sub_pd(a, b); }
+	static Real mul(Real a, Real b) { return _mm_mul_pd(a, b); }
+	static Real div(Real a, Real b) { return _mm_div_pd(a, b); }
+	static Real floor(Real value) { return _mm_floor_pd(value); }
+	static Int toInt(Real value) { return _mm_cvtpd_epi32(value); }
+	static Int setInt(int value) { return _mm_set1_epi32(value); }
+	static Int addInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+	static Int andInt(Int a, Int b) { return _mm_and_si128(a, b); }
+	static Int gather(const int* table, Int index) { return _mm_set_epi32(0, 0, table[_mm_extract_epi32(index, 1)], table[_mm_cvtsi128_si32(index)]); }
+	static Real lookup(const double* table, Int index) { return _mm_set_pd(table[_mm_extract_epi32(index, 1)], table[_mm_cvtsi128_si32(index)]); }
+};
+
+struct SSE41Float {
+	typedef float Scalar;
+	typedef __m128 Real;
+	typedef __m128i Int;
+	static const int Count = 4;
+
+	static Real load(const float* values) { return _mm_loadu_ps(values); }
+	static void store(float* values, Real value) { _mm_storeu_ps(values, value); }
+	static Real set(float value) { return _mm_set1_ps(value); }
+	static Real add(Real a, Real b) { return _mm_add_ps(a, b); }
+	static Real sub(Real a, Real b) { return _mm_sub_ps(a, b); }
+	static Real mul(Real a, Real b) { return _mm_mul_ps(a, b); }
+	static Real div(Real a, Real b) { return _mm_div_ps(a, b); }
+	static Real floor(Real value) { return _mm_floor_ps(value); }
+	static Int toInt(Real value) { return _mm_cvtps_epi32(value); }
+	static Int setInt(int value) { return _mm_set1_epi32(value); }
+	static Int addInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+	static Int andInt(Int a, Int b) { return _mm_and_si128(a, b); }
+	static Int gather(const int* table, Int index) {
+		return _mm_set_epi32(table[_mm_extract_epi32(index, 3)], table[_mm_extract_epi32(index, 2)], table[_mm_extract_epi32(index, 1)], table[_mm_cvtsi128_si32(index)]);
+	}
+	static Real lookup(const float* table, Int index) {
+		return _mm_set_ps(table[_mm_extract_epi32(index, 3)], table[_mm_extract_epi32(index, 2)], table[_mm_extract_epi32(index, 1)], table[_mm_cvtsi128_si32(index)]);
+	}
+};
+
+}
+
+int perlinNoiseSSE41(const int* p, const double* x, const double* y, const double* z, double* out, int count) {
+	return perlinNoiseKernel<SSE41Double>(p, x, y, z, out, count);
+}
+
+int perlinNoiseSSE41(const int* p, const float* x, const float* y, const float* z, float* out, int count) {
+	return perlinNoiseKernel<SSE41Float>(p, x, y, z, out, count);
+}
+
+#endif
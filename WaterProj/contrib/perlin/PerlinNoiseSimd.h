@@ -0,0 +1,112 @@
+// Batched SIMD kernels for PerlinNoise. The kernel is written once against a set of vector operations (the Lanes type),
+// and each instruction set defines its own Lanes type in its own source file, compiled for that instruction set.
+// PerlinNoise picks the best one the CPU supports at runtime.
+
+// Nothing from the standard library is included here. This header is included by files compiled for instruction sets
+// the CPU may not have, and any inline function they shared with the rest of the program could end up built with them.
+
+#ifndef PERLINNOISESIMD_H
+#define PERLINNOISESIMD_H
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PERLIN_SIMD
+#endif
+
+#ifdef PERLIN_SIMD
+
+#include <immintrin.h>
+
+// Each returns how many points it filled in, which is count rounded down to a whole number of vectors. The caller does the rest.
+int perlinNoiseSSE41(const int* p, const double* x, const double* y, const double* z, double* out, int count);
+int perlinNoiseSSE41(const int* p, const float* x, const float* y, const float* z, float* out, int count);
+int perlinNoiseAVX2(const int* p, const double* x, const double* y, const double* z, double* out, int count);
+int perlinNoiseAVX2(const int* p, const float* x, const float* y, const float* z, float* out, int count);
+
+// The gradient of each of the 16 hash values, so that grad() becomes x * gradX[h] + y * gradY[h] + z * gradZ[h]. Every
+// gradient has one zero component and the others are +-1, so this gives exactly the same result as the branches in grad().
+template<typename Lanes>
+typename Lanes::Real perlinGrad(typename Lanes::Int hash, typename Lanes::Real x, typename Lanes::Real y, typename Lanes::Real z) {
+	typedef typename Lanes::Scalar Scalar;
+	alignas(32) static const Scalar gradX[16] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0, 1, 0, -1, 0 };
+	alignas(32) static const Scalar gradY[16] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1, 1, -1, 1, -1 };
+	alignas(32) static const Scalar gradZ[16] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1, 0, 1, 0, -1 };
+
+	typename Lanes::Int h = Lanes::andInt(hash, Lanes::setInt(15));
+	return Lanes::add(Lanes::add(Lanes::mul(x, Lanes::lookup(gradX, h)), Lanes::mul(y, Lanes::lookup(gradY, h))), Lanes::mul(z, Lanes::lookup(gradZ, h)));
+}
+
+template<typename Lanes>
+typename Lanes::Real perlinFade(typename Lanes::Real t) {
+	typedef typename Lanes::Real Real;
+	const Real cube = Lanes::mul(Lanes::mul(t, t), t);
+	const Real inner = Lanes::add(Lanes::mul(t, Lanes::sub(Lanes::mul(t, Lanes::set(6)), Lanes::set(15))), Lanes::set(10));
+	return Lanes::mul(cube, inner);
+}
+
+template<typename Lanes>
+typename Lanes::Real perlinLerp(typename Lanes::Real t, typename Lanes::Real a, typename Lanes::Real b) {
+	return Lanes::add(a, Lanes::mul(t, Lanes::sub(b, a)));
+}
+
+// The same steps as PerlinNoise::noise, in the same order, a vector of points at a time
+template<typename Lanes>
+int perlinNoiseKernel(const int* p, const typename Lanes::Scalar* xs, const typename Lanes::Scalar* ys, const typename Lanes::Scalar* zs, typename Lanes::Scalar* out, int count) {
+	typedef typename Lanes::Real Real;
+	typedef typename Lanes::Int Int;
+	const Int mask = Lanes::setInt(255);
+	const Int oneInt = Lanes::setInt(1);
+	const Real one = Lanes::set(1);
+
+	int i = 0;
+	for (; i + Lanes::Count <= count; i += Lanes::Count) {
+		Real x = Lanes::load(xs + i);
+		Real y = Lanes::load(ys + i);
+		Real z = Lanes::load(zs + i);
+
+		// Find the unit cube that contains the point
+		const Real floorX = Lanes::floor(x);
+		const Real floorY = Lanes::floor(y);
+		const Real floorZ = Lanes::floor(z);
+		const Int X = Lanes::andInt(Lanes::toInt(floorX), mask);
+		const Int Y = Lanes::andInt(Lanes::toInt(floorY), mask);
+		const Int Z = Lanes::andInt(Lanes::toInt(floorZ), mask);
+
+		// Find relative x, y,z of point in cube
+		x = Lanes::sub(x, floorX);
+		y = Lanes::sub(y, floorY);
+		z = Lanes::sub(z, floorZ);
+
+		// Compute fade curves for each of x, y, z
+		const Real u = perlinFade<Lanes>(x);
+		const Real v = perlinFade<Lanes>(y);
+		const Real w = perlinFade<Lanes>(z);
+
+		// Hash coordinates of the 8 cube corners
+		const Int A = Lanes::addInt(Lanes::gather(p, X), Y);
+		const Int AA = Lanes::addInt(Lanes::gather(p, A), Z);
+		const Int AB = Lanes::addInt(Lanes::gather(p, Lanes::addInt(A, oneInt)), Z);
+		const Int B = Lanes::addInt(Lanes::gather(p, Lanes::addInt(X, oneInt)), Y);
+		const Int BA = Lanes::addInt(Lanes::gather(p, B), Z);
+		const Int BB = Lanes::addInt(Lanes::gather(p, Lanes::addInt(B, oneInt)), Z);
+
+		const Real x1 = Lanes::sub(x, one);
+		const Real y1 = Lanes::sub(y, one);
+		const Real z1 = Lanes::sub(z, one);
+
+		// Add blended results from 8 corners of cube
+		const Real front = perlinLerp<Lanes>(v,
+			perlinLerp<Lanes>(u, perlinGrad<Lanes>(Lanes::gather(p, AA), x, y, z), perlinGrad<Lanes>(Lanes::gather(p, BA), x1, y, z)),
+			perlinLerp<Lanes>(u, perlinGrad<Lanes>(Lanes::gather(p, AB), x, y1, z), perlinGrad<Lanes>(Lanes::gather(p, BB), x1, y1, z)));
+		const Real back = perlinLerp<Lanes>(v,
+			perlinLerp<Lanes>(u, perlinGrad<Lanes>(Lanes::gather(p, Lanes::addInt(AA, oneInt)), x, y, z1), perlinGrad<Lanes>(Lanes::gather(p, Lanes::addInt(BA, oneInt)), x1, y, z1)),
+			perlinLerp<Lanes>(u, perlinGrad<Lanes>(Lanes::gather(p, Lanes::addInt(AB, oneInt)), x, y1, z1), perlinGrad<Lanes>(Lanes::gather(p, Lanes::addInt(BB, oneInt)), x1, y1, z1)));
+		const Real res = perlinLerp<Lanes>(w, front, back);
+		Lanes::store(out + i, Lanes::div(Lanes::add(res, one), Lanes::set(2)));
+	}
+
+	return i;
+}
+
+#endif
+
+#endif